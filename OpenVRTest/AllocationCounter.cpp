@@ -0,0 +1,39 @@
+#include "AllocationCounter.h"
+
+#include <stdlib.h>
+#include <new>
+
+#if COUNT_HEAP_ALLOCATIONS
+
+namespace {
+
+thread_local size_t allocationCount = 0;
+
+void* countedAllocate(size_t bytes) {
+	allocationCount++;
+	void* memory = malloc((bytes > 0) ? bytes : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+}
+
+void* operator new(size_t bytes) { return countedAllocate(bytes); }
+void* operator new[](size_t bytes) { return countedAllocate(bytes); }
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+
+size_t heapAllocationCount() {
+	return allocationCount;
+}
+
+#else
+
+size_t heapAllocationCount() {
+	return 0;
+}
+
+#endif
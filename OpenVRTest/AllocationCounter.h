@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+//Replaces the global operator new with one counting the allocations made by
+//each thread, to check that the painting thread's ticks stop allocating once
+//warmed up. Off by default since every allocation in the program pays for it.
+#define COUNT_HEAP_ALLOCATIONS 0
+
+//Heap allocations made by the calling thread so far, always 0 when counting
+//is off
+size_t heapAllocationCount();
@@ -20,10 +20,14 @@ struct StateAtDraw {
 	bool controllerPainting[2];
 };
 
-std::vector<StateAtDraw> loadControllerSequence(const char* filename) {
+inline std::vector<StateAtDraw> loadControllerSequence(const char* filename) {
 	FILE* file = fopen(filename, "r");
 
 	std::vector<StateAtDraw> stateSequence;
+	if (file == nullptr) {
+		printf("loadControllerSequence - Could not open %s\n", filename);
+		return stateSequence;
+	}
 	char startFrameChar;
 	while(fscanf(file, "-------------------%c\n", &startFrameChar) > 0){
 		StateAtDraw state;
@@ -92,11 +96,16 @@ std::vector<StateAtDraw> loadControllerSequence(const char* filename) {
 		stateSequence.push_back(state);
 	}
 
+	fclose(file);
 	return stateSequence;
 }
 
-void saveControllerSequence(const std::vector<StateAtDraw>& stateSequence, const char* filename) {
+inline void saveControllerSequence(const std::vector<StateAtDraw>& stateSequence, const char* filename) {
 	FILE* file = fopen(filename, "w");
+	if (file == nullptr) {
+		printf("saveControllerSequence - Could not open %s\n", filename);
+		return;
+	}
 
 	for (auto state : stateSequence) {
 		fprintf(file, "-------------------|\n");
@@ -162,4 +171,5 @@ void saveControllerSequence(const std::vector<StateAtDraw>& stateSequence, const
 			m[3][0], m[3][1], m[3][2], m[3][3]);
 			*/
 	}
+	fclose(file);
 }
\ No newline at end of file
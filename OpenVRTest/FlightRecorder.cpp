@@ -0,0 +1,116 @@
+#include "FlightRecorder.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+using namespace std;
+
+FlightRecorder::FlightRecorder(size_t frameCapacity, size_t framesAfterHitch, float budgetMs)
+	:frames(std::max(frameCapacity, size_t(1)) + 1), head(0),
+	framesAfterHitch(std::min(framesAfterHitch, std::max(frameCapacity, size_t(1)))), budgetMs(budgetMs),
+	lastEnd(0), dumpFrame(0), nextDumpFrame(0), hitches(0), ticks(0), tickStates(0), maxTickMicroseconds(0)
+{
+	lastEnd = profilerNow();
+	startFrame(lastEnd);
+}
+
+void FlightRecorder::recordTick(size_t states, double seconds) {
+	ticks.fetch_add(1, memory_order_relaxed);
+	tickStates.fetch_add(uint32_t(states), memory_order_relaxed);
+	uint32_t micro = uint32_t(seconds*1e6);
+	uint32_t previous = maxTickMicroseconds.load(memory_order_relaxed);
+	while (micro > previous && !maxTickMicroseconds.compare_exchange_weak(previous, micro, memory_order_relaxed)) {}
+}
+
+bool FlightRecorder::endFrame() {
+	uint64_t now = profilerNow();
+	FlightFrame& frame = current();
+	frame.frameMs = float(double(now - lastEnd)*1e-6);
+	frame.paintingTicks = ticks.exchange(0, memory_order_relaxed);
+	frame.paintingStates = tickStates.exchange(0, memory_order_relaxed);
+	frame.paintingMaxTickMs = float(maxTickMicroseconds.exchange(0, memory_order_relaxed))*1e-3f;
+
+	//The first frame also holds loading, so it isn't a hitch
+	if (head > 0 && frame.frameMs > budgetMs) {
+		hitches++;
+		if (dumpFrame == 0)
+			dumpFrame = std::max(head + framesAfterHitch, nextDumpFrame);
+	}
+	bool dumpDue = dumpFrame != 0 && head >= dumpFrame;
+	if (dumpDue) {
+		dumpFrame = 0;
+		nextDumpFrame = head + (frames.size() - 1);
+	}
+
+	head++;
+	lastEnd = now;
+	startFrame(now);
+	return dumpDue;
+}
+
+void FlightRecorder::startFrame(uint64_t now) {
+	FlightFrame& frame = current();
+	frame = FlightFrame();
+	frame.frame = head;
+	frame.start = now;
+}
+
+vector<FlightFrame> FlightRecorder::recentFrames() const {
+	size_t count = size_t(std::min(head, uint64_t(frames.size() - 1)));
+	vector<FlightFrame> recent;
+	recent.reserve(count);
+	for (uint64_t f = head - count; f < head; f++)
+		recent.push_back(frames[f % frames.size()]);
+	return recent;
+}
+
+bool writeFlightRecord(const string& basename, const vector<FlightFrame>& frames, const vector<string>& stageNames) {
+	if (frames.empty())
+		return false;
+
+	vector<StateAtDraw> states;
+	for (const FlightFrame& frame : frames)
+		states.push_back(frame.state);
+	saveControllerSequence(states, (basename + ".seq").c_str());
+
+	string csvName = basename + ".csv";
+	FILE* f = fopen(csvName.c_str(), "w");
+	if (f == nullptr) {
+		printf("writeFlightRecord - Could not open %s\n", csvName.c_str());
+		return false;
+	}
+	size_t stageNum = std::min(stageNames.size(), MAX_FLIGHT_STAGES);
+	FrameCSVLayout layout;
+	size_t stageColumns[MAX_FLIGHT_STAGES];
+	for (size_t s = 0; s < stageNum; s++)
+		stageColumns[s] = layout.add(profileColumnName(stageNames[s].c_str()));
+	const char* ownColumns[] = { "PaintingTicks", "PaintingStates", "PaintingMaxTickMs", "UploadedPages", "UploadedBytes",
+		"BrushRadius", "Painting0", "Painting1" };
+	size_t firstOwn = layout.size();
+	for (const char* column : ownColumns)
+		layout.add(column);
+	layout.writeHeader(f);
+	for (const FlightFrame& frame : frames) {
+		vector<double> values(layout.size(), 0.0);
+		values[FrameCSVLayout::FRAME_INDEX] = double(frame.frame);
+		values[FrameCSVLayout::SYSTEM_TIME] = double(frame.start)*1e-9 + frame.frameMs*1e-3;
+		values[FrameCSVLayout::FRAME_INTERVAL] = frame.frameMs;
+		for (size_t s = 0; s < stageNum; s++)
+			values[stageColumns[s]] = frame.stageMs[s];
+		double own[] = { double(frame.paintingTicks), double(frame.paintingStates), frame.paintingMaxTickMs,
+			double(frame.uploadedPages), double(frame.uploadedBytes), frame.state.brushRadius,
+			double(frame.state.controllerPainting[0]), double(frame.state.controllerPainting[1]) };
+		for (size_t i = 0; i < sizeof(own) / sizeof(own[0]); i++)
+			values[firstOwn + i] = own[i];
+		layout.writeRow(f, values);
+	}
+	fclose(f);
+
+#if ENABLE_PROFILER
+	//Zones ending after the first recorded frame started, which includes whatever is still running
+	vector<ProfileThreadEvents> profile = collectProfileEvents(frames.front().start);
+	writeProfileTrace((basename + ".json").c_str(), profile);
+#endif
+	return true;
+}
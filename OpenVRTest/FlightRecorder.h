@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ControllerMovement.h"
+
+const size_t MAX_FLIGHT_STAGES = 8;
+
+//Flight recorder options
+constexpr float FLIGHT_HITCH_PERIODS = 1.5f;	//Frames longer than this many frame periods missed a vsync and count as hitches
+constexpr size_t FLIGHT_DUMP_FILES = 8;			//Dumps cycle through saved/flight0 to saved/flight7
+
+//What happened during one frame of the painting loop
+struct FlightFrame {
+	uint64_t frame;
+	uint64_t start;						//Profiler clock, nanoseconds
+	float frameMs;						//From the previous frame's end to this one's
+	float stageMs[MAX_FLIGHT_STAGES];	//Last run of each pipeline stage
+	uint32_t paintingTicks;				//Painting thread ticks finished during the frame
+	uint32_t paintingStates;			//States they handled
+	float paintingMaxTickMs;
+	uint32_t uploadedPages;				//Label pages sent to the GPU
+	uint32_t uploadedBytes;
+	StateAtDraw state;					//Controller and view sample, as in a .seq
+};
+
+//Always on record of the last frames. The main thread fills current() during
+//a frame and closes it with endFrame(), the painting thread adds its ticks
+//through atomics. A frame over budget schedules a dump framesAfterHitch frames
+//later, so the dump shows what led up to the hitch and what followed it, and
+//hitches in between end up in the same dump. Dumps are at least frameCapacity
+//frames apart, so a run of hitches gives one dump per window of frames rather
+//than one per hitch, and no frame is dumped twice.
+class FlightRecorder {
+public:
+	FlightRecorder(size_t frameCapacity, size_t framesAfterHitch, float budgetMs);
+
+	FlightFrame& current() { return frames[head % frames.size()]; }
+
+	//Painting thread side
+	void recordTick(size_t states, double seconds);
+
+	//Closes the current frame. Returns true when a scheduled dump is due.
+	bool endFrame();
+
+	//Closed frames, oldest first
+	std::vector<FlightFrame> recentFrames() const;
+	size_t hitchCount() const { return hitches; }
+	float budget() const { return budgetMs; }
+
+private:
+	std::vector<FlightFrame> frames;		//One more than the capacity, for the current frame
+	uint64_t head;							//Frames closed
+	size_t framesAfterHitch;
+	float budgetMs;
+	uint64_t lastEnd;
+	uint64_t dumpFrame;						//Frame the scheduled dump is due at, 0 when none is
+	uint64_t nextDumpFrame;					//Earliest frame the next dump may be due at
+	size_t hitches;
+
+	std::atomic<uint32_t> ticks;
+	std::atomic<uint32_t> tickStates;
+	std::atomic<uint32_t> maxTickMicroseconds;
+
+	void startFrame(uint64_t now);
+};
+
+//Writes basename.seq with the controller samples, which loads with
+//loadControllerSequence so the hitch can be replayed, basename.csv with one
+//row per frame, and basename.json with the profiler zones of those frames
+//when the profiler is on
+bool writeFlightRecord(const std::string& basename, const std::vector<FlightFrame>& frames,
+	const std::vector<std::string>& stageNames);
@@ -0,0 +1,58 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+
+using namespace std;
+
+FrameArena::FrameArena(size_t blockSize) :current(0), offset(0), usedBeforeCurrent(0), blockSize(blockSize) {}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+	while (true) {
+		if (current < blocks.size()) {
+			Block& block = blocks[current];
+			size_t start = (offset + alignment - 1) & ~(alignment - 1);
+			if (start + bytes <= block.size) {
+				offset = start + bytes;
+				return block.data.get() + start;
+			}
+			usedBeforeCurrent += offset;
+			offset = 0;
+			current++;
+			if (current < blocks.size())
+				continue;
+		}
+
+		//New block big enough for the request, blocks are at least blockSize
+		Block block;
+		block.size = std::max(blockSize, bytes + alignment);
+		block.data.reset(new unsigned char[block.size]);
+		blocks.push_back(move(block));
+		current = blocks.size() - 1;
+	}
+}
+
+void FrameArena::reset() {
+	if (blocks.size() > 1) {
+		size_t total = capacity();
+		blocks.clear();
+		Block block;
+		block.size = total;
+		block.data.reset(new unsigned char[block.size]);
+		blocks.push_back(move(block));
+	}
+	current = 0;
+	offset = 0;
+	usedBeforeCurrent = 0;
+}
+
+size_t FrameArena::capacity() const {
+	size_t total = 0;
+	for (const Block& block : blocks)
+		total += block.size;
+	return total;
+}
+
+FrameArena& threadFrameArena() {
+	static thread_local FrameArena arena;
+	return arena;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <utility>
+#include <stddef.h>
+
+//Bump allocator for temporaries that only live until the end of a frame or
+//painting tick. Allocations are carved out of a block in order and are never
+//freed individually. reset() rewinds to the start, and if the last frame
+//needed more than one block they are replaced by a single block of the total
+//size, so a frame that fits allocates nothing from the heap.
+class FrameArena {
+public:
+	static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+	FrameArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment);
+	void reset();
+
+	size_t bytesUsed() const { return usedBeforeCurrent + offset; }
+	size_t capacity() const;
+
+private:
+	struct Block {
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t current;				//Block being carved
+	size_t offset;				//Bytes used in it
+	size_t usedBeforeCurrent;	//Bytes used in earlier blocks
+	size_t blockSize;
+};
+
+//Arena of the calling thread, reset by whoever owns that thread's loop
+FrameArena& threadFrameArena();
+
+//Standard allocator drawing from a FrameArena. Deallocation is a no-op, the
+//memory comes back when the arena is reset, so containers using it must not
+//outlive the frame.
+template<typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	ArenaAllocator(FrameArena& arena = threadFrameArena()) :arena(&arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) :arena(other.arena) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T))); }
+	void deallocate(T*, size_t) {}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+	template<typename U> friend class ArenaAllocator;
+	FrameArena* arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template<typename Key, typename T>
+using ArenaMap = std::map<Key, T, std::less<Key>, ArenaAllocator<std::pair<const Key, T>>>;
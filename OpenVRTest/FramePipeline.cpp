@@ -0,0 +1,147 @@
+#include "FramePipeline.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+using namespace std;
+
+FramePipeline::FramePipeline(size_t framesInFlight, size_t reportFrames)
+	:framesInFlight(std::max(framesInFlight, size_t(1))), reportFrames(reportFrames), frame(0) {}
+
+FramePipeline::~FramePipeline() {
+	waitAll();
+	for (auto& stage : stages) {
+		if (stage->affinity != STAGE_WORKER)
+			continue;
+		{
+			lock_guard<std::mutex> lock(mutex);
+			stage->stopping = true;
+		}
+		stage->jobQueued.notify_all();
+		stage->thread.join();
+	}
+}
+
+FramePipeline::Stage FramePipeline::addStage(string name, StageAffinity affinity) {
+	auto stage = make_unique<StageInfo>();
+	stage->name = name;
+	stage->affinity = affinity;
+	stage->profileName = profileName(name);
+	if (affinity == STAGE_WORKER)
+		stage->thread = std::thread(&FramePipeline::workerFunc, this, stage.get());
+
+	lock_guard<std::mutex> lock(mutex);
+	stages.push_back(move(stage));
+	return stages.size() - 1;
+}
+
+void FramePipeline::begin(Stage stage) {
+	stages[stage]->started = Clock::now();
+#if ENABLE_PROFILER
+	stages[stage]->profileStarted = profilerNow();
+#endif
+}
+
+void FramePipeline::end(Stage stage) {
+	StageInfo* info = stages[stage].get();
+	record(info, chrono::duration<double>(Clock::now() - info->started).count());
+#if ENABLE_PROFILER
+	profileRecord(info->profileName, info->profileStarted, profilerNow());
+#endif
+}
+
+void FramePipeline::run(Stage stage, function<void()> job) {
+	StageInfo* info = stages[stage].get();
+	if (info->affinity == STAGE_MAIN) {
+		begin(stage);
+		job();
+		end(stage);
+		return;
+	}
+
+	unique_lock<std::mutex> lock(mutex);
+	info->jobFinished.wait(lock, [&]() { return info->pending < framesInFlight; });
+	info->jobs.push_back(move(job));
+	info->pending++;
+	lock.unlock();
+	info->jobQueued.notify_one();
+}
+
+void FramePipeline::wait(Stage stage) {
+	StageInfo* info = stages[stage].get();
+	if (info->affinity == STAGE_MAIN)
+		return;
+	unique_lock<std::mutex> lock(mutex);
+	info->jobFinished.wait(lock, [&]() { return info->pending == 0; });
+}
+
+bool FramePipeline::idle(Stage stage) const {
+	lock_guard<std::mutex> lock(mutex);
+	return stages[stage]->pending == 0;
+}
+
+void FramePipeline::waitAll() {
+	for (Stage stage = 0; stage < stages.size(); stage++)
+		wait(stage);
+}
+
+void FramePipeline::workerFunc(StageInfo* stage) {
+	PROFILE_THREAD(stage->profileName);
+	unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		stage->jobQueued.wait(lock, [&]() { return stage->stopping || !stage->jobs.empty(); });
+		if (stage->jobs.empty())
+			return;
+		function<void()> job = move(stage->jobs.front());
+		stage->jobs.pop_front();
+		lock.unlock();
+
+		Clock::time_point started = Clock::now();
+		{
+			PROFILE_ZONE(stage->profileName);
+			job();
+		}
+		record(stage, chrono::duration<double>(Clock::now() - started).count());
+
+		lock.lock();
+		stage->pending--;
+		stage->jobFinished.notify_all();
+	}
+}
+
+void FramePipeline::record(StageInfo* stage, double seconds) {
+	lock_guard<std::mutex> lock(mutex);
+	stage->timing.runs++;
+	stage->timing.totalSeconds += seconds;
+	stage->timing.maxSeconds = std::max(stage->timing.maxSeconds, seconds);
+	stage->lastSeconds = seconds;
+}
+
+StageTiming FramePipeline::timing(Stage stage) const {
+	lock_guard<std::mutex> lock(mutex);
+	return stages[stage]->timing;
+}
+
+double FramePipeline::lastSeconds(Stage stage) const {
+	lock_guard<std::mutex> lock(mutex);
+	return stages[stage]->lastSeconds;
+}
+
+void FramePipeline::endFrame() {
+	frame++;
+	if (reportFrames > 0 && frame % reportFrames == 0)
+		report();
+}
+
+void FramePipeline::report() {
+	lock_guard<std::mutex> lock(mutex);
+	printf("FramePipeline::report - %zu frames\n", frame);
+	for (auto& stage : stages) {
+		const StageTiming& timing = stage->timing;
+		double average = (timing.runs > 0) ? timing.totalSeconds / double(timing.runs) : 0.0;
+		printf("  %-20s %-6s %6zu runs  avg %7.3f ms  max %7.3f ms\n", stage->name.c_str(),
+			(stage->affinity == STAGE_MAIN) ? "main" : "worker", timing.runs, average*1000.0, timing.maxSeconds*1000.0);
+		stage->timing = StageTiming();
+	}
+}
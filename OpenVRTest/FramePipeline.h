@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+enum StageAffinity : int {
+	STAGE_MAIN = 0,		//Runs on the thread driving the frame, needed for anything touching GL
+	STAGE_WORKER		//Runs on a thread of its own, in the order its jobs were queued
+};
+
+struct StageTiming {
+	size_t runs;
+	double totalSeconds;
+	double maxSeconds;
+	StageTiming() :runs(0), totalSeconds(0.0), maxSeconds(0.0) {}
+};
+
+//Named stages of a painting loop frame. Main stages are timed with
+//begin/end around code already running on the main thread. Worker stages
+//take jobs through run(), which return immediately, so their work overlaps
+//whatever the main thread does until it waits on the stage. A worker stage
+//may hold jobs from up to framesInFlight frames before run() blocks, so a
+//slow job such as a save can spill into the following frames without
+//holding up the one that started it.
+class FramePipeline {
+public:
+	typedef size_t Stage;
+
+	FramePipeline(size_t framesInFlight = 2, size_t reportFrames = 0);
+	~FramePipeline();		//Finishes every queued job
+
+	//Stages are all added before the first frame
+	Stage addStage(std::string name, StageAffinity affinity);
+
+	//Times a main stage
+	void begin(Stage stage);
+	void end(Stage stage);
+
+	//Queues job on a worker stage, or runs it in place on a main stage
+	void run(Stage stage, std::function<void()> job);
+	//Blocks until every job queued on the stage has finished
+	void wait(Stage stage);
+	//Whether nothing is queued or running on the stage
+	bool idle(Stage stage) const;
+	void waitAll();
+
+	//Counts frames and prints the report every reportFrames frames
+	void endFrame();
+
+	//Timing since the last report
+	StageTiming timing(Stage stage) const;
+	//Duration of the stage's most recent run
+	double lastSeconds(Stage stage) const;
+	size_t stageCount() const { return stages.size(); }
+	const std::string& stageName(Stage stage) const { return stages[stage]->name; }
+	void report();
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct StageInfo {
+		std::string name;
+		StageAffinity affinity;
+		StageTiming timing;
+		double lastSeconds = 0.0;
+		Clock::time_point started;
+		const char* profileName = nullptr;
+		uint64_t profileStarted = 0;
+
+		//Worker stages only
+		std::thread thread;
+		std::deque<std::function<void()>> jobs;
+		size_t pending = 0;		//Queued plus running
+		bool stopping = false;
+		std::condition_variable jobQueued;
+		std::condition_variable jobFinished;
+	};
+
+	size_t framesInFlight;
+	size_t reportFrames;
+	size_t frame;
+	std::vector<std::unique_ptr<StageInfo>> stages;
+	mutable std::mutex mutex;
+
+	void workerFunc(StageInfo* stage);
+	void record(StageInfo* stage, double seconds);
+};
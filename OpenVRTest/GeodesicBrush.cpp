@@ -0,0 +1,71 @@
+#include "GeodesicBrush.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace glm;
+using namespace std;
+
+GeodesicBrush::GeodesicBrush(size_t vertexNum) :generation(0) {
+	resize(vertexNum);
+}
+
+void GeodesicBrush::resize(size_t vertexNum) {
+	distances.assign(vertexNum, 0.f);
+	stamps.assign(vertexNum, 0);
+	generation = 0;
+}
+
+void GeodesicBrush::nextGeneration() {
+	generation++;
+	if (generation == 0) {
+		//Stamps wrapped around, old stamps could match again
+		std::fill(stamps.begin(), stamps.end(), 0);
+		generation = 1;
+	}
+}
+
+void GeodesicBrush::query(uint32_t seed, vec3 center, float radius,
+	const vec3* positions, const MeshAdjacency& adjacency,
+	std::vector<uint32_t>* reached)
+{
+	if (seed >= distances.size())
+		return;
+
+	float seedDistance = length(positions[seed] - center);
+	if (seedDistance > radius)
+		return;
+
+	nextGeneration();
+	front.clear();
+
+	auto heapOrder = greater<pair<float, uint32_t>>();
+	distances[seed] = seedDistance;
+	stamps[seed] = generation;
+	front.push_back({ seedDistance, seed });
+
+	while (!front.empty()) {
+		pop_heap(front.begin(), front.end(), heapOrder);
+		pair<float, uint32_t> current = front.back();
+		front.pop_back();
+
+		uint32_t v = current.second;
+		//Skip stale entries left behind by a later decrease
+		if (current.first > distances[v])
+			continue;
+
+		reached->push_back(v);
+
+		for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++) {
+			float d = current.first + length(positions[*n] - positions[v]);
+			if (d > radius)
+				continue;
+			if (stamps[*n] != generation || d < distances[*n]) {
+				stamps[*n] = generation;
+				distances[*n] = d;
+				front.push_back({ d, *n });
+				push_heap(front.begin(), front.end(), heapOrder);
+			}
+		}
+	}
+}
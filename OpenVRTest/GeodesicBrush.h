@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "MeshAdjacency.h"
+
+//Brush that selects vertices by distance along the mesh rather than through
+//space, so painting one side of a thin fold leaves the other side alone.
+//Distances are found with a Dijkstra front over mesh edges that stops at the
+//brush radius. The per-vertex distance array is reused between queries and
+//validated with a generation stamp, so a query only touches the vertices it
+//reaches.
+class GeodesicBrush {
+	std::vector<float> distances;
+	std::vector<uint32_t> stamps;		//Generation in which distances[v] was last written
+	uint32_t generation;
+	std::vector<std::pair<float, uint32_t>> front;		//Min heap of (distance, vertex)
+
+	void nextGeneration();
+public:
+	GeodesicBrush() :generation(0) {}
+	GeodesicBrush(size_t vertexNum);
+
+	void resize(size_t vertexNum);
+
+	//Appends every vertex within radius of center, measured as the straight
+	//line distance from center to seed plus the edge path length from seed
+	void query(uint32_t seed, glm::vec3 center, float radius,
+		const glm::vec3* positions, const MeshAdjacency& adjacency,
+		std::vector<uint32_t>* reached);
+};
@@ -0,0 +1,232 @@
+#include "LabelExport.h"
+#include "ParallelFor.h"
+#include "UnionFind.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <../tinyply/source/tinyply.h>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+const uint32_t NO_COMPONENT = 0xffffffff;
+
+//Sorts the indices [0, count) into buckets by key, keeping them in order
+//within each bucket. Keys equal to NO_COMPONENT are left out.
+void bucketByKey(const uint32_t* keys, size_t count, size_t bucketNum,
+	vector<uint32_t>* offsets, vector<uint32_t>* sorted)
+{
+	offsets->assign(bucketNum + 1, 0);
+	for (size_t i = 0; i < count; i++) {
+		if (keys[i] != NO_COMPONENT)
+			(*offsets)[keys[i]]++;
+	}
+	uint32_t total = parallelExclusiveScan(offsets->data(), bucketNum + 1);
+
+	sorted->resize(total);
+	vector<uint32_t> cursor(offsets->begin(), offsets->end() - 1);
+	for (size_t i = 0; i < count; i++) {
+		if (keys[i] != NO_COMPONENT)
+			(*sorted)[cursor[keys[i]]++] = uint32_t(i);
+	}
+}
+
+}
+
+void findLabelComponents(const unsigned char* labels, size_t vertexNum,
+	const unsigned int* faces, unsigned int faceNum, LabelComponents* components)
+{
+	//Components end up rooted at their lowest vertex
+	ConcurrentUnionFind sets(vertexNum);
+	parallelFor(0, faceNum, [&](size_t f) {
+		for (size_t corner = 0; corner < 3; corner++) {
+			uint32_t a = faces[3 * f + corner];
+			uint32_t b = faces[3 * f + (corner + 1) % 3];
+			if (labels[a] == labels[b])
+				sets.unite(a, b);
+		}
+	});
+
+	//Number the roots in vertex order
+	vector<uint32_t> roots(vertexNum + 1, 0);
+	components->component.resize(vertexNum);
+	parallelFor(0, vertexNum, [&](size_t v) {
+		components->component[v] = sets.find(uint32_t(v));
+		roots[v] = (components->component[v] == v) ? 1 : 0;
+	});
+	uint32_t componentNum = parallelExclusiveScan(roots.data(), vertexNum + 1);
+
+	components->componentLabel.resize(componentNum);
+	parallelFor(0, vertexNum, [&](size_t v) {
+		uint32_t root = components->component[v];
+		if (root == v)
+			components->componentLabel[roots[v]] = labels[v];
+	});
+	parallelFor(0, vertexNum, [&](size_t v) {
+		components->component[v] = roots[components->component[v]];
+	});
+}
+
+size_t exportLabelSegments(string prefix, SegmentGrouping grouping,
+	const unsigned int* faces, unsigned int faceNum,
+	const vec3* positions, const vec3* normals, const unsigned char* labels,
+	const vec3* colorMap, size_t colorMapNum, size_t vertexNum, Bitmask visibility)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	LabelComponents components;
+	findLabelComponents(labels, vertexNum, faces, faceNum, &components);
+	size_t componentNum = components.componentCount();
+	const vector<uint32_t>& component = components.component;
+
+	//A face belongs to a component if its corners share a label, since its
+	//edges then joined them
+	vector<uint32_t> faceComponent(faceNum);
+	parallelFor(0, faceNum, [&](size_t f) {
+		unsigned int a = faces[3 * f], b = faces[3 * f + 1], c = faces[3 * f + 2];
+		faceComponent[f] = (labels[a] == labels[b] && labels[a] == labels[c]) ? component[a] : NO_COMPONENT;
+	});
+
+	vector<uint32_t> vertexOffsets, componentVertices;
+	vector<uint32_t> faceOffsets, componentFaces;
+	bucketByKey(component.data(), vertexNum, componentNum, &vertexOffsets, &componentVertices);
+	bucketByKey(faceComponent.data(), faceNum, componentNum, &faceOffsets, &componentFaces);
+
+	//Position of each vertex within its component
+	vector<uint32_t> localIndex(vertexNum);
+	parallelFor(0, componentNum, [&](size_t c) {
+		for (uint32_t i = vertexOffsets[c]; i < vertexOffsets[c + 1]; i++)
+			localIndex[componentVertices[i]] = i - vertexOffsets[c];
+	}, 256);
+
+	vector<ComponentSummary> summaries(componentNum);
+	parallelFor(0, componentNum, [&](size_t c) {
+		ComponentSummary& summary = summaries[c];
+		summary.component = uint32_t(c);
+		summary.label = components.componentLabel[c];
+		summary.vertexNum = vertexOffsets[c + 1] - vertexOffsets[c];
+		summary.faceNum = faceOffsets[c + 1] - faceOffsets[c];
+		summary.boundsMin = summary.boundsMax = positions[componentVertices[vertexOffsets[c]]];
+		for (uint32_t i = vertexOffsets[c]; i < vertexOffsets[c + 1]; i++) {
+			summary.boundsMin = min(summary.boundsMin, positions[componentVertices[i]]);
+			summary.boundsMax = max(summary.boundsMax, positions[componentVertices[i]]);
+		}
+		summary.area = 0.0;
+		for (uint32_t i = faceOffsets[c]; i < faceOffsets[c + 1]; i++) {
+			const unsigned int* face = faces + 3 * size_t(componentFaces[i]);
+			summary.area += 0.5*length(cross(positions[face[1]] - positions[face[0]], positions[face[2]] - positions[face[0]]));
+		}
+	}, 256);
+
+	//Components making up each output file
+	vector<vector<uint32_t>> outputs;
+	if (grouping == GROUP_BY_LABEL) {
+		vector<vector<uint32_t>> labelComponents(256);
+		for (uint32_t c = 0; c < componentNum; c++) {
+			if (summaries[c].faceNum > 0)
+				labelComponents[summaries[c].label].push_back(c);
+		}
+		for (size_t label = 0; label < labelComponents.size(); label++) {
+			if (!labelComponents[label].empty() && !visibility.test(label))
+				outputs.push_back(labelComponents[label]);
+		}
+	}
+	else {
+		for (uint32_t c = 0; c < componentNum; c++) {
+			if (summaries[c].faceNum > 0 && !visibility.test(summaries[c].label))
+				outputs.push_back({ c });
+		}
+	}
+
+	atomic<size_t> written(0);
+	parallelFor(0, outputs.size(), [&](size_t o) {
+		const vector<uint32_t>& group = outputs[o];
+		unsigned char label = summaries[group[0]].label;
+
+		size_t groupVertexNum = 0, groupFaceNum = 0;
+		for (uint32_t c : group) {
+			groupVertexNum += summaries[c].vertexNum;
+			groupFaceNum += summaries[c].faceNum;
+		}
+
+		vector<vec3> newPositions, newNormals;
+		vector<unsigned char> newColors;
+		vector<uint32_t> newFaces;
+		newPositions.reserve(groupVertexNum);
+		newNormals.reserve(groupVertexNum);
+		newColors.reserve(3 * groupVertexNum);
+		newFaces.reserve(3 * groupFaceNum);
+
+		vec3 color = (colorMapNum > 0) ? colorMap[std::min(size_t(label), colorMapNum - 1)] * 255.f : vec3(255.f);
+		for (uint32_t c : group) {
+			uint32_t base = uint32_t(newPositions.size());
+			for (uint32_t i = vertexOffsets[c]; i < vertexOffsets[c + 1]; i++) {
+				newPositions.push_back(positions[componentVertices[i]]);
+				newNormals.push_back(normals[componentVertices[i]]);
+				newColors.push_back((unsigned char)(color.x));
+				newColors.push_back((unsigned char)(color.y));
+				newColors.push_back((unsigned char)(color.z));
+			}
+			for (uint32_t i = faceOffsets[c]; i < faceOffsets[c + 1]; i++) {
+				const unsigned int* face = faces + 3 * size_t(componentFaces[i]);
+				for (int corner = 0; corner < 3; corner++)
+					newFaces.push_back(base + localIndex[face[corner]]);
+			}
+		}
+
+		stringstream filename;
+		if (grouping == GROUP_BY_LABEL)
+			filename << prefix << "_label" << int(label) << ".ply";
+		else
+			filename << prefix << "_component" << group[0] << "_label" << int(label) << ".ply";
+
+		std::filebuf fb;
+		fb.open(filename.str(), std::ios::out | std::ios::binary);
+		std::ostream outstream(&fb);
+		if (!fb.is_open() || outstream.fail()) {
+			printf("exportLabelSegments - File %s could not be opened\n", filename.str().c_str());
+			return;
+		}
+
+		using namespace tinyply;
+
+		PlyFile plyOutput;
+		plyOutput.add_properties_to_element("vertex", { "x", "y", "z" },
+			Type::FLOAT32, newPositions.size(), reinterpret_cast<uint8_t*>(newPositions.data()), Type::INVALID, 0);
+		plyOutput.add_properties_to_element("vertex", { "nx", "ny", "nz" },
+			Type::FLOAT32, newNormals.size(), reinterpret_cast<uint8_t*>(newNormals.data()), Type::INVALID, 0);
+		plyOutput.add_properties_to_element("vertex", { "red", "green", "blue" },
+			Type::UINT8, newPositions.size(), newColors.data(), Type::INVALID, 0);
+		plyOutput.add_properties_to_element("face", { "vertex_indices" },
+			Type::UINT32, newFaces.size() / 3, reinterpret_cast<uint8_t*>(newFaces.data()), Type::UINT8, 3);
+		plyOutput.write(outstream, true);
+		fb.close();
+
+		written++;
+	}, 1);
+
+	string summaryFilename = prefix + "_components.csv";
+	ofstream f(summaryFilename.c_str());
+	if (f.is_open()) {
+		f << "Component,Label,Vertices,Faces,Area,MinX,MinY,MinZ,MaxX,MaxY,MaxZ" << endl;
+		for (const auto& summary : summaries) {
+			f << summary.component << ',' << int(summary.label) << ','
+				<< summary.vertexNum << ',' << summary.faceNum << ',' << summary.area << ','
+				<< summary.boundsMin.x << ',' << summary.boundsMin.y << ',' << summary.boundsMin.z << ','
+				<< summary.boundsMax.x << ',' << summary.boundsMax.y << ',' << summary.boundsMax.z << endl;
+		}
+	}
+	else
+		printf("exportLabelSegments - File %s could not be opened\n", summaryFilename.c_str());
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("exportLabelSegments - %zu components, wrote %zu files in %.3f s\n", componentNum, written.load(), seconds);
+
+	return written;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include <Bitmask.h>
+
+//Connected components of the mesh where two vertices are connected if they
+//share an edge and a label. Components are numbered by their lowest vertex
+//index, so the numbering does not depend on thread timing.
+struct LabelComponents {
+	std::vector<uint32_t> component;			//Component of each vertex
+	std::vector<unsigned char> componentLabel;
+
+	size_t componentCount() const { return componentLabel.size(); }
+};
+
+//Lock-free union-find over the face edges, split across worker threads
+void findLabelComponents(const unsigned char* labels, size_t vertexNum,
+	const unsigned int* faces, unsigned int faceNum, LabelComponents* components);
+
+struct ComponentSummary {
+	uint32_t component;
+	unsigned char label;
+	size_t vertexNum;
+	size_t faceNum;
+	double area;
+	glm::vec3 boundsMin, boundsMax;
+};
+
+enum SegmentGrouping : int {
+	GROUP_BY_LABEL = 0,
+	GROUP_BY_COMPONENT
+};
+
+//Writes one binary PLY per label or per component, named
+//prefix_label<n>.ply or prefix_component<n>_label<m>.ply, plus a CSV summary
+//of every component in prefix_components.csv. Faces whose corners have
+//different labels are dropped, and each file only holds the vertices of its
+//own components with compacted indices. Hidden labels are skipped. Labels
+//past the end of colorMap take its last color. Files are written concurrently.
+//Returns the number of PLY files written.
+size_t exportLabelSegments(std::string prefix, SegmentGrouping grouping,
+	const unsigned int* faces, unsigned int faceNum,
+	const glm::vec3* positions, const glm::vec3* normals, const unsigned char* labels,
+	const glm::vec3* colorMap, size_t colorMapNum, size_t vertexNum, Bitmask visibility);
@@ -0,0 +1,181 @@
+#include "LabelMorphology.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+namespace {
+
+//Most common value, the lowest value winning ties. Sorts values.
+unsigned char majority(vector<unsigned char>& values, int* count) {
+	sort(values.begin(), values.end());
+	unsigned char best = values[0];
+	int bestCount = 0;
+	for (size_t i = 0; i < values.size();) {
+		size_t runEnd = i;
+		while (runEnd < values.size() && values[runEnd] == values[i])
+			runEnd++;
+		if (int(runEnd - i) > bestCount) {
+			best = values[i];
+			bestCount = int(runEnd - i);
+		}
+		i = runEnd;
+	}
+	*count = bestCount;
+	return best;
+}
+
+//Runs up to passes passes of rule(v, current, scratch), which returns the
+//next label of v. Changes are written to a second buffer and copied back
+//after each pass. Later passes only visit vertices next to a change.
+template<typename Rule>
+shared_ptr<LabelChangeOperation> runPasses(int passes, const unsigned char* labels,
+	const MeshAdjacency& adjacency, Rule rule, const char* name)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	size_t vertexNum = adjacency.vertexCount();
+	vector<unsigned char> current(labels, labels + vertexNum);
+	vector<unsigned char> next = current;
+	VertexSet everChanged(vertexNum);
+
+	size_t wordNum = everChanged.wordCount();
+	unique_ptr<atomic<uint64_t>[]> marked(new atomic<uint64_t>[wordNum]);
+
+	vector<uint32_t> candidates;
+	bool allCandidates = true;
+	int passNum = 0;
+	for (; passNum < passes; passNum++) {
+		size_t candidateNum = (allCandidates) ? vertexNum : candidates.size();
+		size_t chunkNum = chunkCount(candidateNum);
+		vector<vector<uint32_t>> chunkChanged(chunkNum);
+		parallelChunks(0, candidateNum, chunkNum, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+			vector<unsigned char> scratch;
+			for (size_t i = chunkBegin; i < chunkEnd; i++) {
+				uint32_t v = (allCandidates) ? uint32_t(i) : candidates[i];
+				unsigned char label = rule(v, current.data(), scratch);
+				if (label != current[v]) {
+					next[v] = label;
+					chunkChanged[chunk].push_back(v);
+				}
+			}
+		});
+
+		vector<uint32_t> changed;
+		for (const auto& local : chunkChanged)
+			changed.insert(changed.end(), local.begin(), local.end());
+		if (changed.empty())
+			break;
+
+		parallelFor(0, changed.size(), [&](size_t i) { current[changed[i]] = next[changed[i]]; });
+		for (uint32_t v : changed)
+			everChanged.set(v);
+
+		if (passNum + 1 == passes)
+			continue;
+
+		//Next candidates are the changed vertices and their neighbours, in index order
+		parallelFor(0, wordNum, [&](size_t w) { marked[w].store(0, memory_order_relaxed); });
+		auto mark = [&](uint32_t v) { marked[v >> 6].fetch_or(uint64_t(1) << (v & 63), memory_order_relaxed); };
+		parallelFor(0, changed.size(), [&](size_t i) {
+			uint32_t v = changed[i];
+			mark(v);
+			for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++)
+				mark(*n);
+		}, 1024);
+		candidates.clear();
+		for (size_t w = 0; w < wordNum; w++) {
+			uint64_t word = marked[w].load(memory_order_relaxed);
+			while (word) {
+				candidates.push_back(uint32_t(w * 64 + countTrailingZeros(word)));
+				word &= word - 1;
+			}
+		}
+		allCandidates = false;
+	}
+
+	auto operation = make_shared<LabelChangeOperation>();
+	everChanged.forEach([&](size_t v) {
+		if (current[v] != labels[v]) {
+			operation->indices.push_back(uint32_t(v));
+			operation->oldLabels.push_back(labels[v]);
+			operation->newLabels.push_back(current[v]);
+		}
+	});
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("%s - %zu vertices changed over %d passes in %.3f s\n", name, operation->indices.size(), passNum, seconds);
+
+	if (operation->indices.empty())
+		return nullptr;
+	return operation;
+}
+
+bool canChange(uint32_t v, const unsigned char* current, Bitmask hidden, const VertexSet* scope) {
+	return !hidden.test(current[v]) && (!scope || scope->test(v));
+}
+
+}
+
+shared_ptr<LabelChangeOperation> dilateLabel(unsigned char label, int rings,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden, const VertexSet* scope)
+{
+	if (hidden.test(label))
+		return nullptr;
+
+	return runPasses(rings, labels, adjacency, [&](uint32_t v, const unsigned char* current, vector<unsigned char>&) {
+		if (current[v] == label || !canChange(v, current, hidden, scope))
+			return current[v];
+		for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++) {
+			if (current[*n] == label)
+				return label;
+		}
+		return current[v];
+	}, "dilateLabel");
+}
+
+shared_ptr<LabelChangeOperation> erodeLabel(unsigned char label, int rings,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden, const VertexSet* scope)
+{
+	if (hidden.test(label))
+		return nullptr;
+
+	return runPasses(rings, labels, adjacency, [&](uint32_t v, const unsigned char* current, vector<unsigned char>& scratch) {
+		if (current[v] != label || !canChange(v, current, hidden, scope))
+			return current[v];
+		scratch.clear();
+		for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++) {
+			if (current[*n] != label && !hidden.test(current[*n]))
+				scratch.push_back(current[*n]);
+		}
+		if (scratch.empty())
+			return current[v];
+		int count;
+		return majority(scratch, &count);
+	}, "erodeLabel");
+}
+
+shared_ptr<LabelChangeOperation> smoothLabels(int passes,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden, const VertexSet* scope)
+{
+	return runPasses(passes, labels, adjacency, [&](uint32_t v, const unsigned char* current, vector<unsigned char>& scratch) {
+		if (!canChange(v, current, hidden, scope))
+			return current[v];
+		scratch.clear();
+		scratch.push_back(current[v]);
+		int ownCount = 1;
+		for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++) {
+			if (!hidden.test(current[*n])) {
+				scratch.push_back(current[*n]);
+				ownCount += (current[*n] == current[v]) ? 1 : 0;
+			}
+		}
+		int bestCount;
+		unsigned char best = majority(scratch, &bestCount);
+		return (bestCount > ownCount) ? best : current[v];
+	}, "smoothLabels");
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <Bitmask.h>
+
+#include "LabelOps.h"
+#include "MeshAdjacency.h"
+
+//Morphology over the mesh adjacency. Every pass reads the labels left by the
+//previous pass and writes to a second buffer, so results do not depend on
+//the thread count. After the first pass only neighbours of vertices that
+//changed are revisited. Hidden vertices never change and never count as
+//neighbours. If scope is not null only vertices in it may change.
+//Each returns one operation for the undo stack, or nullptr if nothing would
+//change. The caller applies it to each copy of the labels.
+
+//Grows label outwards by rings
+std::shared_ptr<LabelChangeOperation> dilateLabel(unsigned char label, int rings,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden, const VertexSet* scope = nullptr);
+
+//Shrinks label by rings. Boundary vertices take the most common other label
+//around them, the lowest label winning ties.
+std::shared_ptr<LabelChangeOperation> erodeLabel(unsigned char label, int rings,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden, const VertexSet* scope = nullptr);
+
+//Each pass gives every vertex the most common label among itself and its
+//neighbours, if that label is strictly more common than its own
+std::shared_ptr<LabelChangeOperation> smoothLabels(int passes,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden, const VertexSet* scope = nullptr);
@@ -0,0 +1,268 @@
+#include "LabelOps.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define LABELOPS_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+//Frontiers smaller than this are expanded on the calling thread
+const size_t PARALLEL_FRONTIER = 4096;
+
+void setLabels(const VertexSet& vertices, unsigned char label, unsigned char* labels) {
+	const uint64_t* words = vertices.data();
+	size_t fullWordNum = vertices.size() / 64;
+	parallelForRange(0, vertices.wordCount(), [&](size_t firstWord, size_t lastWord) {
+		for (size_t w = firstWord; w < lastWord; w++) {
+			//Bulk operations mostly produce runs of full words
+			if (words[w] == ~uint64_t(0) && w < fullWordNum)
+				memset(labels + w * 64, label, 64);
+			else
+				vertices.forEachInWords(w, w + 1, [&](size_t v) { labels[v] = label; });
+		}
+	}, 1024);
+}
+
+//Bits of labels[0..n) equal to label, n <= 64
+uint64_t compareLabels(const unsigned char* labels, size_t n, unsigned char label) {
+	uint64_t word = 0;
+	size_t i = 0;
+#ifdef LABELOPS_SSE
+	__m128i target = _mm_set1_epi8(char(label));
+	for (; i + 16 <= n; i += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(labels + i));
+		uint64_t mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(block, target)));
+		word |= mask << i;
+	}
+#endif
+	for (; i < n; i++) {
+		if (labels[i] == label)
+			word |= uint64_t(1) << i;
+	}
+	return word;
+}
+
+shared_ptr<LabelMoveOperation> makeOperation(vector<LabelMoveOperation::Move>& moves, const char* name) {
+	size_t changed = 0;
+	for (const auto& move : moves)
+		changed += move.vertices.count();
+	if (changed == 0)
+		return nullptr;
+
+	auto operation = make_shared<LabelMoveOperation>();
+	operation->moves.swap(moves);
+	printf("%s - %zu vertices\n", name, changed);
+	return operation;
+}
+
+//Vertices reachable from seed through edges to vertices passing follow(v)
+template<typename Follow>
+VertexSet findConnected(uint32_t seed, const MeshAdjacency& adjacency, Follow follow) {
+	VertexSet region(adjacency.vertexCount());
+	size_t wordNum = region.wordCount();
+	unique_ptr<atomic<uint64_t>[]> visited(new atomic<uint64_t>[wordNum]);
+	parallelFor(0, wordNum, [&](size_t w) { visited[w].store(0, memory_order_relaxed); });
+
+	//Returns true for the one thread that marks v first
+	auto visit = [&](uint32_t v) {
+		uint64_t bit = uint64_t(1) << (v & 63);
+		return !(visited[v >> 6].fetch_or(bit, memory_order_relaxed) & bit);
+	};
+
+	vector<uint32_t> frontier = { seed };
+	vector<uint32_t> nextFrontier;
+	visit(seed);
+
+	while (!frontier.empty()) {
+		nextFrontier.clear();
+		if (frontier.size() < PARALLEL_FRONTIER) {
+			for (uint32_t v : frontier) {
+				for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++) {
+					if (follow(*n) && visit(*n))
+						nextFrontier.push_back(*n);
+				}
+			}
+		}
+		else {
+			//Each chunk collects what it visits, then the chunks are concatenated
+			size_t chunkNum = chunkCount(frontier.size(), PARALLEL_FRONTIER / 4);
+			vector<vector<uint32_t>> chunkFrontiers(chunkNum);
+			parallelChunks(0, frontier.size(), chunkNum, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+				auto& local = chunkFrontiers[chunk];
+				for (size_t i = chunkBegin; i < chunkEnd; i++) {
+					uint32_t v = frontier[i];
+					for (const uint32_t* n = adjacency.begin(v); n != adjacency.end(v); n++) {
+						if (follow(*n) && visit(*n))
+							local.push_back(*n);
+					}
+				}
+			});
+			for (const auto& local : chunkFrontiers)
+				nextFrontier.insert(nextFrontier.end(), local.begin(), local.end());
+		}
+		frontier.swap(nextFrontier);
+	}
+
+	parallelFor(0, wordNum, [&](size_t w) { region.data()[w] = visited[w].load(memory_order_relaxed); });
+	return region;
+}
+
+}
+
+size_t VertexSet::count() const {
+	size_t total = 0;
+	for (uint64_t word : words)
+		total += popCount(word);
+	return total;
+}
+
+void LabelMoveOperation::apply(unsigned char* labels) const {
+	for (const auto& move : moves)
+		setLabels(move.vertices, move.to, labels);
+}
+
+void LabelMoveOperation::revert(unsigned char* labels) const {
+	for (auto it = moves.rbegin(); it != moves.rend(); it++)
+		setLabels(it->vertices, it->from, labels);
+}
+
+size_t LabelMoveOperation::memoryUsage() const {
+	size_t total = sizeof(*this) + moves.capacity()*sizeof(Move);
+	for (const auto& move : moves)
+		total += move.vertices.memoryUsage();
+	return total;
+}
+
+void LabelMoveOperation::forEachChange(const function<void(size_t, unsigned char, unsigned char)>& func) const {
+	for (const auto& move : moves)
+		move.vertices.forEach([&](size_t v) { func(v, move.from, move.to); });
+}
+
+void LabelChangeOperation::apply(unsigned char* labels) const {
+	parallelFor(0, indices.size(), [&](size_t i) { labels[indices[i]] = newLabels[i]; });
+}
+
+void LabelChangeOperation::revert(unsigned char* labels) const {
+	parallelFor(0, indices.size(), [&](size_t i) { labels[indices[i]] = oldLabels[i]; });
+}
+
+size_t LabelChangeOperation::memoryUsage() const {
+	return sizeof(*this) + indices.capacity()*sizeof(uint32_t) + oldLabels.capacity() + newLabels.capacity();
+}
+
+void LabelChangeOperation::forEachChange(const function<void(size_t, unsigned char, unsigned char)>& func) const {
+	for (size_t i = 0; i < indices.size(); i++)
+		func(indices[i], oldLabels[i], newLabels[i]);
+}
+
+VertexSet findConnectedRegion(uint32_t seed, const unsigned char* labels,
+	const MeshAdjacency& adjacency, Bitmask hidden)
+{
+	if (seed >= adjacency.vertexCount() || hidden.test(labels[seed]))
+		return VertexSet(adjacency.vertexCount());
+
+	unsigned char label = labels[seed];
+	return findConnected(seed, adjacency, [labels, label](uint32_t v) { return labels[v] == label; });
+}
+
+shared_ptr<LabelMoveOperation> floodFill(uint32_t seed, unsigned char newLabel,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden)
+{
+	if (seed >= adjacency.vertexCount() || labels[seed] == newLabel)
+		return nullptr;
+
+	auto start = chrono::high_resolution_clock::now();
+
+	LabelMoveOperation::Move move;
+	move.from = labels[seed];
+	move.to = newLabel;
+	move.vertices = findConnectedRegion(seed, labels, adjacency, hidden);
+	size_t filled = move.vertices.count();
+	if (filled == 0)
+		return nullptr;
+
+	auto operation = make_shared<LabelMoveOperation>();
+	operation->moves.push_back(std::move(move));
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("floodFill - Found %zu vertices from label %d to %d in %.3f s\n",
+		filled, int(operation->moves[0].from), int(newLabel), seconds);
+
+	return operation;
+}
+
+VertexSet findConnectedPiece(uint32_t seed, const MeshAdjacency& adjacency) {
+	//Every edge is followed, so no labels are needed
+	size_t vertexNum = adjacency.vertexCount();
+	if (seed >= vertexNum)
+		return VertexSet(vertexNum);
+	return findConnected(seed, adjacency, [](uint32_t) { return true; });
+}
+
+const char* labelScopeName(int scope) {
+	switch (scope) {
+	case SCOPE_ALL: return "whole model";
+	case SCOPE_BRUSH: return "brush";
+	case SCOPE_REGION: return "piece under brush";
+	default: return "unknown";
+	}
+}
+
+VertexSet findLabel(unsigned char label, const unsigned char* labels, size_t count, const VertexSet* scope) {
+	VertexSet found(count);
+	uint64_t* words = found.data();
+	parallelForRange(0, found.wordCount(), [&](size_t firstWord, size_t lastWord) {
+		for (size_t w = firstWord; w < lastWord; w++) {
+			size_t first = w * 64;
+			words[w] = compareLabels(labels + first, std::min(count - first, size_t(64)), label);
+			if (scope)
+				words[w] &= scope->data()[w];
+		}
+	}, 1024);
+	return found;
+}
+
+shared_ptr<LabelMoveOperation> replaceLabel(unsigned char from, unsigned char to,
+	const unsigned char* labels, size_t count, Bitmask hidden, const VertexSet* scope)
+{
+	if (from == to || hidden.test(from))
+		return nullptr;
+
+	vector<LabelMoveOperation::Move> moves(1);
+	moves[0].from = from;
+	moves[0].to = to;
+	moves[0].vertices = findLabel(from, labels, count, scope);
+	return makeOperation(moves, "replaceLabel");
+}
+
+shared_ptr<LabelMoveOperation> swapLabels(unsigned char a, unsigned char b,
+	const unsigned char* labels, size_t count, Bitmask hidden, const VertexSet* scope)
+{
+	if (a == b || hidden.test(a) || hidden.test(b))
+		return nullptr;
+
+	//Both sets are found before either is applied
+	vector<LabelMoveOperation::Move> moves(2);
+	moves[0].from = a;
+	moves[0].to = b;
+	moves[0].vertices = findLabel(a, labels, count, scope);
+	moves[1].from = b;
+	moves[1].to = a;
+	moves[1].vertices = findLabel(b, labels, count, scope);
+	return makeOperation(moves, "swapLabels");
+}
+
+shared_ptr<LabelMoveOperation> clearLabel(unsigned char label,
+	const unsigned char* labels, size_t count, Bitmask hidden, const VertexSet* scope)
+{
+	return replaceLabel(label, 0, labels, count, hidden, scope);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <Bitmask.h>
+
+#include "UndoStack.h"
+#include "MeshAdjacency.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline unsigned int countTrailingZeros(uint64_t word) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+inline unsigned int popCount(uint64_t word) {
+#ifdef _MSC_VER
+	return static_cast<unsigned int>(__popcnt64(word));
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+//Set of vertex indices stored as one bit per vertex
+class VertexSet {
+	std::vector<uint64_t> words;
+	size_t elementNum;
+public:
+	VertexSet(size_t elementNum = 0) :words((elementNum + 63) / 64, 0), elementNum(elementNum) {}
+
+	size_t size() const { return elementNum; }
+	size_t wordCount() const { return words.size(); }
+	uint64_t* data() { return words.data(); }
+	const uint64_t* data() const { return words.data(); }
+
+	bool test(size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+	void set(size_t i) { words[i >> 6] |= uint64_t(1) << (i & 63); }
+
+	size_t count() const;
+	size_t memoryUsage() const { return words.capacity()*sizeof(uint64_t); }
+
+	//Calls func(index) for every set index in [firstWord*64, lastWord*64)
+	template<typename Func>
+	void forEachInWords(size_t firstWord, size_t lastWord, Func func) const {
+		for (size_t w = firstWord; w < lastWord; w++) {
+			uint64_t word = words[w];
+			while (word) {
+				func(w * 64 + countTrailingZeros(word));
+				word &= word - 1;
+			}
+		}
+	}
+
+	template<typename Func>
+	void forEach(Func func) const { forEachInWords(0, words.size(), func); }
+};
+
+//Relabels sets of vertices. Every vertex in a move's set had label from
+//before the operation and has label to after it.
+class LabelMoveOperation : public UndoOperation<unsigned char> {
+public:
+	struct Move {
+		VertexSet vertices;
+		unsigned char from, to;
+	};
+
+	std::vector<Move> moves;
+
+	void apply(unsigned char* labels) const override;
+	void revert(unsigned char* labels) const override;
+	size_t memoryUsage() const override;
+	void forEachChange(const std::function<void(size_t, unsigned char, unsigned char)>& func) const override;
+};
+
+//Gives each listed vertex its own new label. Suits changes without a common
+//source or destination label.
+class LabelChangeOperation : public UndoOperation<unsigned char> {
+public:
+	std::vector<uint32_t> indices;
+	std::vector<unsigned char> oldLabels;
+	std::vector<unsigned char> newLabels;
+
+	void apply(unsigned char* labels) const override;
+	void revert(unsigned char* labels) const override;
+	size_t memoryUsage() const override;
+	void forEachChange(const std::function<void(size_t, unsigned char, unsigned char)>& func) const override;
+};
+
+//Finds every vertex connected to seed through edges whose endpoints both carry
+//the seed's label. Nothing is found if the seed's label is hidden.
+VertexSet findConnectedRegion(uint32_t seed, const unsigned char* labels,
+	const MeshAdjacency& adjacency, Bitmask hidden);
+
+//Operation relabelling the region connected to seed with newLabel, or nullptr
+//if nothing would change. The caller applies it to each copy of the labels.
+std::shared_ptr<LabelMoveOperation> floodFill(uint32_t seed, unsigned char newLabel,
+	const unsigned char* labels, const MeshAdjacency& adjacency, Bitmask hidden);
+
+//Vertices reachable from seed through any edge, regardless of label
+VertexSet findConnectedPiece(uint32_t seed, const MeshAdjacency& adjacency);
+
+//Which vertices the bulk operations below touch
+enum LabelScope : int {
+	SCOPE_ALL = 0,
+	SCOPE_BRUSH,		//Vertices inside the brush
+	SCOPE_REGION,		//Connected piece of the mesh under the brush
+	SCOPE_NUM
+};
+
+const char* labelScopeName(int scope);
+
+//Every vertex with the given label, restricted to scope if it is not null
+VertexSet findLabel(unsigned char label, const unsigned char* labels, size_t count, const VertexSet* scope = nullptr);
+
+//Bulk relabelling. Each returns a single operation for the undo stack, or
+//nullptr if nothing would change or a label involved is hidden. The caller
+//applies it to each copy of the labels.
+std::shared_ptr<LabelMoveOperation> replaceLabel(unsigned char from, unsigned char to,
+	const unsigned char* labels, size_t count, Bitmask hidden, const VertexSet* scope = nullptr);
+std::shared_ptr<LabelMoveOperation> swapLabels(unsigned char a, unsigned char b,
+	const unsigned char* labels, size_t count, Bitmask hidden, const VertexSet* scope = nullptr);
+std::shared_ptr<LabelMoveOperation> clearLabel(unsigned char label,
+	const unsigned char* labels, size_t count, Bitmask hidden, const VertexSet* scope = nullptr);
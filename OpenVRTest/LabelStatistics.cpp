@@ -0,0 +1,106 @@
+#include "LabelStatistics.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <fstream>
+
+using namespace glm;
+using namespace std;
+
+void LabelTotals::clear() {
+	for (size_t i = 0; i < LABEL_NUM; i++) {
+		counts[i] = 0;
+		areas[i] = 0.0;
+	}
+}
+
+LabelTotals& LabelTotals::operator+=(const LabelTotals& other) {
+	for (size_t i = 0; i < LABEL_NUM; i++) {
+		counts[i] += other.counts[i];
+		areas[i] += other.areas[i];
+	}
+	return *this;
+}
+
+void LabelStatistics::computeVertexAreas(const vec3* positions, const unsigned int* faces, unsigned int faceNum, size_t vertexNum) {
+	vector<float> faceThirds(faceNum);
+	parallelFor(0, faceNum, [&](size_t f) {
+		vec3 a = positions[faces[3 * f]];
+		vec3 b = positions[faces[3 * f + 1]];
+		vec3 c = positions[faces[3 * f + 2]];
+		faceThirds[f] = 0.5f*length(cross(b - a, c - a)) / 3.f;
+	});
+
+	//Scattering to shared vertices is left serial so the sums are deterministic
+	vertexArea.assign(vertexNum, 0.f);
+	for (size_t f = 0; f < faceNum; f++) {
+		for (size_t corner = 0; corner < 3; corner++)
+			vertexArea[faces[3 * f + corner]] += faceThirds[f];
+	}
+}
+
+void LabelStatistics::recount(const unsigned char* labels, size_t count) {
+	if (vertexArea.size() < count)
+		vertexArea.resize(count, 0.f);
+
+	size_t chunkNum = chunkCount(count, 65536);
+	vector<LabelTotals> chunkTotals(chunkNum);
+	parallelChunks(0, count, chunkNum, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+		LabelTotals& local = chunkTotals[chunk];
+		for (size_t i = chunkBegin; i < chunkEnd; i++) {
+			local.counts[labels[i]]++;
+			local.areas[labels[i]] += vertexArea[i];
+		}
+	});
+
+	LabelTotals total;
+	for (const auto& local : chunkTotals)
+		total += local;
+
+	lock_guard<std::mutex> lock(mutex);
+	current = total;
+}
+
+void LabelStatistics::accumulate(LabelTotals* delta, const UndoOperation<unsigned char>& operation, bool reverted) const {
+	operation.forEachChange([&](size_t vertex, unsigned char oldLabel, unsigned char newLabel) {
+		if (reverted)
+			accumulate(delta, vertex, newLabel, oldLabel);
+		else
+			accumulate(delta, vertex, oldLabel, newLabel);
+	});
+}
+
+void LabelStatistics::commit(const LabelTotals& delta) {
+	lock_guard<std::mutex> lock(mutex);
+	current += delta;
+}
+
+LabelTotals LabelStatistics::totals() const {
+	lock_guard<std::mutex> lock(mutex);
+	return current;
+}
+
+bool LabelStatistics::save(string filename, const vec3* labelColors, size_t labelColorNum) const {
+	ofstream f(filename.c_str());
+	if (!f.is_open()) {
+		printf("LabelStatistics::save - File %s could not be opened\n", filename.c_str());
+		return false;
+	}
+
+	LabelTotals snapshot = totals();
+	double totalArea = 0.0;
+	for (size_t i = 0; i < LABEL_NUM; i++)
+		totalArea += snapshot.areas[i];
+
+	f << "Label,Red,Green,Blue,Vertices,Area,AreaFraction" << endl;
+	for (size_t i = 0; i < LABEL_NUM; i++) {
+		if (snapshot.counts[i] == 0 && i >= labelColorNum)
+			continue;
+		vec3 color = (i < labelColorNum) ? labelColors[i] : vec3(0.f);
+		f << i << ',' << color.x << ',' << color.y << ',' << color.z << ','
+			<< snapshot.counts[i] << ',' << snapshot.areas[i] << ','
+			<< ((totalArea > 0.0) ? snapshot.areas[i] / totalArea : 0.0) << endl;
+	}
+
+	return f.good();
+}
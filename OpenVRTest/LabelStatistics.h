@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "UndoStack.h"
+
+const size_t LABEL_NUM = 256;
+
+//Vertex count and surface area of every label
+struct LabelTotals {
+	int64_t counts[LABEL_NUM];
+	double areas[LABEL_NUM];
+
+	LabelTotals() { clear(); }
+	void clear();
+	LabelTotals& operator+=(const LabelTotals& other);
+};
+
+//Per label totals kept up to date from the changes the painting thread makes.
+//Each vertex owns a third of the area of every face it belongs to, so moving
+//a vertex between labels moves a fixed amount of area. Changes are gathered
+//into a LabelTotals delta and committed under a lock so other threads can
+//read totals() at any time.
+class LabelStatistics {
+public:
+	//Parallel over the faces, called once at load
+	void computeVertexAreas(const glm::vec3* positions, const unsigned int* faces, unsigned int faceNum, size_t vertexNum);
+
+	//Full count, used at load and after loading a new .clr
+	void recount(const unsigned char* labels, size_t count);
+
+	void accumulate(LabelTotals* delta, size_t vertex, unsigned char oldLabel, unsigned char newLabel) const {
+		float area = vertexArea[vertex];
+		delta->counts[oldLabel]--;
+		delta->areas[oldLabel] -= area;
+		delta->counts[newLabel]++;
+		delta->areas[newLabel] += area;
+	}
+	void accumulate(LabelTotals* delta, const UndoOperation<unsigned char>& operation, bool reverted) const;
+
+	void commit(const LabelTotals& delta);
+
+	LabelTotals totals() const;
+	float area(size_t vertex) const { return vertexArea[vertex]; }
+	size_t memoryUsage() const { return vertexArea.capacity()*sizeof(float); }
+
+	//Writes label, color, vertex count, area and fraction of the total area for
+	//every label in use as CSV
+	bool save(std::string filename, const glm::vec3* labelColors, size_t labelColorNum) const;
+
+private:
+	std::vector<float> vertexArea;
+	LabelTotals current;
+	mutable std::mutex mutex;
+};
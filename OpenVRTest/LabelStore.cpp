@@ -0,0 +1,128 @@
+#include "LabelStore.h"
+
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+void LabelStore::Snapshot::copyTo(unsigned char* out) const {
+	for (size_t p = 0; p < pageCount(); p++)
+		memcpy(out + p*PAGE_SIZE, page(p), pageLength(p));
+}
+
+vector<unsigned char> LabelStore::Snapshot::toVector() const {
+	vector<unsigned char> labels(size());
+	copyTo(labels.data());
+	return labels;
+}
+
+LabelStore::LabelStore(const vector<unsigned char>& labels) :currentEpoch(1) {
+	size_t pageNum = (labels.size() + PAGE_SIZE - 1) / PAGE_SIZE;
+	auto table = make_shared<Table>();
+	table->pages.reserve(pageNum);
+	for (size_t p = 0; p < pageNum; p++) {
+		size_t begin = p*PAGE_SIZE;
+		size_t end = std::min(begin + PAGE_SIZE, labels.size());
+		table->pages.push_back(make_shared<Page>(labels.begin() + begin, labels.begin() + end));
+	}
+	table->epochs.assign(pageNum, 1);
+	table->epoch = 1;
+	table->count = labels.size();
+	current = table;
+	dirty.assign(pageNum, 0);
+}
+
+LabelStore::Snapshot LabelStore::snapshot() const {
+	lock_guard<std::mutex> lock(mutex);
+	return Snapshot(current);
+}
+
+void LabelStore::markAll() {
+	std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+uint64_t LabelStore::publish(const unsigned char* labels) {
+	//Only this thread replaces the table, so it can be read without the lock
+	if (std::find(dirty.begin(), dirty.end(), 1) == dirty.end())
+		return current->epoch;
+
+	uint64_t epoch = current->epoch + 1;
+	shared_ptr<Table> table = reuseTable();
+	*table = *current;
+
+	//Pages nothing else holds any more can be overwritten
+	size_t kept = 0;
+	for (size_t i = 0; i < retiredPages.size(); i++) {
+		if (retiredPages[i].use_count() == 1 && sparePages.size() < MAX_SPARE_PAGES)
+			sparePages.push_back(move(retiredPages[i]));
+		else if (retiredPages[i].use_count() > 1)
+			retiredPages[kept++] = move(retiredPages[i]);
+	}
+	retiredPages.resize(kept);
+
+	for (size_t p = 0; p < dirty.size(); p++) {
+		if (!dirty[p])
+			continue;
+		size_t begin = p*PAGE_SIZE;
+		size_t end = std::min(begin + PAGE_SIZE, table->count);
+		shared_ptr<Page> page = reusePage();
+		page->assign(labels + begin, labels + end);
+		retiredPages.push_back(move(table->pages[p]));
+		table->pages[p] = move(page);
+		table->epochs[p] = epoch;
+		dirty[p] = 0;
+	}
+	table->epoch = epoch;
+
+	shared_ptr<const Table> replaced;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		replaced = current;
+		current = table;
+	}
+	retiredTables.push_back(move(replaced));
+	currentEpoch.store(epoch, memory_order_release);
+	return epoch;
+}
+
+shared_ptr<LabelStore::Table> LabelStore::reuseTable() {
+	for (size_t i = 0; i < retiredTables.size(); i++) {
+		if (retiredTables[i].use_count() == 1) {
+			shared_ptr<Table> table = const_pointer_cast<Table>(retiredTables[i]);
+			retiredTables.erase(retiredTables.begin() + i);
+			return table;
+		}
+	}
+	return make_shared<Table>();
+}
+
+shared_ptr<LabelStore::Page> LabelStore::reusePage() {
+	if (sparePages.empty())
+		return make_shared<Page>();
+	shared_ptr<Page> page = const_pointer_cast<Page>(sparePages.back());
+	sparePages.pop_back();
+	return page;
+}
+
+size_t LabelStore::memoryUsage() const {
+	auto tableBytes = [](const Table& table) {
+		return table.pages.capacity()*sizeof(shared_ptr<const Page>) + table.epochs.capacity()*sizeof(uint64_t);
+	};
+
+	Snapshot latest = snapshot();
+	size_t bytes = tableBytes(*latest.table);
+	for (size_t p = 0; p < latest.pageCount(); p++)
+		bytes += latest.pageLength(p);
+
+	//Replaced pages and tables are held until reused, whether or not a
+	//snapshot still needs them
+	for (const auto& page : retiredPages)
+		bytes += page->capacity();
+	for (const auto& page : sparePages)
+		bytes += page->capacity();
+	for (const auto& table : retiredTables)
+		bytes += tableBytes(*table);
+	bytes += (retiredPages.capacity() + sparePages.capacity())*sizeof(shared_ptr<const Page>)
+		+ retiredTables.capacity()*sizeof(shared_ptr<const Table>) + dirty.capacity();
+	return bytes;
+}
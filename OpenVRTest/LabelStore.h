@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+//Per vertex labels shared between the painting thread and everyone reading
+//them. The labels are split into pages of PAGE_SIZE that are never modified
+//once published. Publishing copies the pages the writer dirtied into new
+//pages, stamps them with the next epoch and swaps in a new page table, so a
+//Snapshot keeps seeing the table it was taken from and is always consistent.
+//Unchanged pages are shared between tables. Replaced pages and tables are
+//kept once the last snapshot holding them goes away, and reused by later
+//publishes, so steady painting doesn't allocate.
+class LabelStore {
+public:
+	static constexpr size_t PAGE_SIZE = 4096;
+
+	typedef std::vector<unsigned char> Page;
+
+	class Snapshot {
+	public:
+		Snapshot() {}
+
+		size_t size() const { return (table) ? table->count : 0; }
+		uint64_t epoch() const { return (table) ? table->epoch : 0; }
+		unsigned char operator[](size_t i) const { return (*table->pages[i / PAGE_SIZE])[i % PAGE_SIZE]; }
+
+		size_t pageCount() const { return (table) ? table->pages.size() : 0; }
+		const unsigned char* page(size_t p) const { return table->pages[p]->data(); }
+		size_t pageLength(size_t p) const { return table->pages[p]->size(); }
+		uint64_t pageEpoch(size_t p) const { return table->epochs[p]; }
+
+		void copyTo(unsigned char* out) const;
+		std::vector<unsigned char> toVector() const;
+
+	private:
+		friend class LabelStore;
+		struct Table {
+			std::vector<std::shared_ptr<const Page>> pages;
+			std::vector<uint64_t> epochs;		//Epoch each page was last published in
+			uint64_t epoch;
+			size_t count;
+		};
+		std::shared_ptr<const Table> table;
+
+		Snapshot(std::shared_ptr<const Table> table) :table(std::move(table)) {}
+	};
+
+	LabelStore(const std::vector<unsigned char>& labels);
+
+	//Labels as of the last publish. Safe from any thread.
+	Snapshot snapshot() const;
+	uint64_t epoch() const { return currentEpoch.load(std::memory_order_acquire); }
+
+	//Writer side, only called from the thread that owns the working labels
+	void markChanged(size_t vertex) { dirty[vertex / PAGE_SIZE] = 1; }
+	void markAll();
+	//Publishes the dirty pages of labels, which has the store's size. Returns
+	//the new epoch, or the current one if nothing was dirty.
+	uint64_t publish(const unsigned char* labels);
+
+	//Bytes held by the current table and its pages, and by the replaced ones
+	//kept for reuse. Writer side.
+	size_t memoryUsage() const;
+
+private:
+	typedef Snapshot::Table Table;
+
+	static constexpr size_t MAX_SPARE_PAGES = 256;
+
+	mutable std::mutex mutex;
+	std::shared_ptr<const Table> current;
+	std::atomic<uint64_t> currentEpoch;
+	std::vector<char> dirty;
+
+	//Writer side. Retired entries may still be held by snapshots, spare ones
+	//are only held here.
+	std::vector<std::shared_ptr<const Page>> retiredPages;
+	std::vector<std::shared_ptr<const Page>> sparePages;
+	std::vector<std::shared_ptr<const Table>> retiredTables;
+
+	std::shared_ptr<Table> reuseTable();
+	std::shared_ptr<Page> reusePage();
+};
@@ -0,0 +1,107 @@
+#include "LabelTransfer.h"
+#include "VertexKDTree.h"
+#include "VolumeIO.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace glm;
+using namespace std;
+using namespace renderlib;
+
+namespace {
+
+const int MAX_TRANSFER_NEIGHBOURS = 64;
+const size_t TRANSFER_BLOCK = 1 << 20;		//Queries answered per batch
+
+}
+
+void transferLabels(const vec3* oldPositions, const unsigned char* oldLabels, size_t oldNum,
+	const vec3* newPositions, size_t newNum, int k, unsigned char* newLabels)
+{
+	//Nothing to take labels from
+	if (oldNum == 0) {
+		fill(newLabels, newLabels + newNum, (unsigned char)0);
+		return;
+	}
+
+	VertexKDTree kdTree;
+	kdTree.build(oldPositions, oldNum);
+	size_t neighbourNum = size_t(std::max(1, std::min(k, MAX_TRANSFER_NEIGHBOURS)));
+
+	//Results for a block of queries at a time keeps the buffers bounded
+	size_t blockSize = std::min(newNum, TRANSFER_BLOCK);
+	vector<size_t> vertices(blockSize*neighbourNum);
+	vector<float> distancesSquared(blockSize*neighbourNum);
+
+	for (size_t blockBegin = 0; blockBegin < newNum; blockBegin += blockSize) {
+		size_t blockEnd = std::min(newNum, blockBegin + blockSize);
+		kdTree.findKNearestBatch(newPositions + blockBegin, blockEnd - blockBegin, neighbourNum,
+			vertices.data(), distancesSquared.data());
+
+		parallelForRange(0, blockEnd - blockBegin, [&](size_t chunkBegin, size_t chunkEnd) {
+			int counts[256] = {};
+			for (size_t q = chunkBegin; q < chunkEnd; q++) {
+				const size_t* nearest = vertices.data() + q*neighbourNum;
+
+				//Nearest first, so the first label to reach the highest count wins ties
+				unsigned char best = oldLabels[nearest[0]];
+				int bestCount = 0;
+				for (size_t i = 0; i < neighbourNum && nearest[i] != size_t(-1); i++) {
+					unsigned char label = oldLabels[nearest[i]];
+					if (++counts[label] > bestCount) {
+						best = label;
+						bestCount = counts[label];
+					}
+				}
+				for (size_t i = 0; i < neighbourNum && nearest[i] != size_t(-1); i++)
+					counts[oldLabels[nearest[i]]] = 0;
+
+				newLabels[blockBegin + q] = best;
+			}
+		}, 1024);
+	}
+}
+
+bool transferLabelFile(string oldClr, string newModel, string outClr, int k) {
+	auto start = chrono::high_resolution_clock::now();
+
+	MeshInfoLoader oldMinfo;
+	vector<unsigned char> oldLabels;
+	string oldObjName;
+	if (!loadVolume(oldClr, &oldMinfo, &oldLabels, &oldObjName)) {
+		printf("transferLabelFile - Could not load %s\n", oldClr.c_str());
+		return false;
+	}
+	if (oldLabels.size() != oldMinfo.vertices.size()) {
+		printf("transferLabelFile - %s has %zu labels for %zu vertices\n",
+			oldClr.c_str(), oldLabels.size(), oldMinfo.vertices.size());
+		return false;
+	}
+
+	MeshInfoLoader newMinfo;
+	bool loaded = false;
+	if (hasExtension(newModel, ".obj"))
+		loaded = newMinfo.loadModel(newModel.c_str());
+	else if (hasExtension(newModel, ".ply"))
+		loaded = newMinfo.loadModelPly(newModel.c_str());
+	if (!loaded) {
+		printf("transferLabelFile - Could not load %s\n", newModel.c_str());
+		return false;
+	}
+
+	vector<unsigned char> newLabels(newMinfo.vertices.size(), 0);
+	transferLabels(oldMinfo.vertices.data(), oldLabels.data(), oldLabels.size(),
+		newMinfo.vertices.data(), newMinfo.vertices.size(), k, newLabels.data());
+
+	if (!saveVolume(outClr, newModel, newLabels.data(), newLabels.size()))
+		return false;
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("transferLabelFile - %zu labels onto %zu vertices of %s in %.3f s\n",
+		oldLabels.size(), newLabels.size(), newModel.c_str(), seconds);
+	return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <glm/glm.hpp>
+
+//Gives each new vertex the label of its nearest old vertex, or with k > 1 the
+//most common label among its k nearest old vertices. Labels are counted
+//outward from the nearest vertex, and of tied labels the one that reached the
+//top count first wins, which need not be the nearest vertex's label. Runs in
+//parallel over the new vertices.
+void transferLabels(const glm::vec3* oldPositions, const unsigned char* oldLabels, size_t oldNum,
+	const glm::vec3* newPositions, size_t newNum, int k, unsigned char* newLabels);
+
+//Carries the labels in oldClr onto newModel (.obj or .ply), for instance an
+//isosurface extracted again with different parameters, and saves them to outClr
+bool transferLabelFile(std::string oldClr, std::string newModel, std::string outClr, int k = 1);
@@ -0,0 +1,62 @@
+#include "MemoryTracker.h"
+
+#include <stdio.h>
+#include <atomic>
+
+using namespace std;
+
+namespace {
+
+atomic<size_t> current[MEMORY_SUBSYSTEM_NUM];
+atomic<size_t> peak[MEMORY_SUBSYSTEM_NUM];
+atomic<size_t> total(0);
+atomic<size_t> totalPeak(0);
+
+void raiseHighWater(atomic<size_t>& highWater, size_t value) {
+	size_t previous = highWater.load(memory_order_relaxed);
+	while (value > previous && !highWater.compare_exchange_weak(previous, value, memory_order_relaxed)) {}
+}
+
+double megabytes(size_t bytes) { return double(bytes) / (1024.0*1024.0); }
+
+}
+
+const char* memorySubsystemName(MemorySubsystem subsystem) {
+	switch (subsystem) {
+	case MEMORY_MESH: return "Mesh";
+	case MEMORY_SPATIAL_INDEX: return "Spatial index";
+	case MEMORY_LABELS: return "Labels";
+	case MEMORY_UNDO: return "Undo";
+	case MEMORY_IO: return "I/O buffers";
+	case MEMORY_GPU: return "GPU buffers";
+	default: return "Unknown";
+	}
+}
+
+void chargeTrackedMemory(MemorySubsystem subsystem, size_t bytes) {
+	if (bytes == 0)
+		return;
+	size_t now = current[subsystem].fetch_add(bytes, memory_order_relaxed) + bytes;
+	raiseHighWater(peak[subsystem], now);
+	raiseHighWater(totalPeak, total.fetch_add(bytes, memory_order_relaxed) + bytes);
+}
+
+void releaseTrackedMemory(MemorySubsystem subsystem, size_t bytes) {
+	current[subsystem].fetch_sub(bytes, memory_order_relaxed);
+	total.fetch_sub(bytes, memory_order_relaxed);
+}
+
+size_t trackedMemory(MemorySubsystem subsystem) { return current[subsystem].load(memory_order_relaxed); }
+size_t trackedMemoryPeak(MemorySubsystem subsystem) { return peak[subsystem].load(memory_order_relaxed); }
+size_t trackedMemoryTotal() { return total.load(memory_order_relaxed); }
+size_t trackedMemoryTotalPeak() { return totalPeak.load(memory_order_relaxed); }
+
+void printMemoryReport(const char* reason) {
+	printf("Memory - %s\n", reason);
+	for (int s = 0; s < MEMORY_SUBSYSTEM_NUM; s++) {
+		MemorySubsystem subsystem = MemorySubsystem(s);
+		printf("  %-14s %9.1f MB  peak %9.1f MB\n", memorySubsystemName(subsystem),
+			megabytes(trackedMemory(subsystem)), megabytes(trackedMemoryPeak(subsystem)));
+	}
+	printf("  %-14s %9.1f MB  peak %9.1f MB\n", "Total", megabytes(trackedMemoryTotal()), megabytes(trackedMemoryTotalPeak()));
+}
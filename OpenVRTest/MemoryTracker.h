@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+
+enum MemorySubsystem : int {
+	MEMORY_MESH = 0,		//Positions, normals, indices and connectivity
+	MEMORY_SPATIAL_INDEX,	//Vertex index and ray picking BVH
+	MEMORY_LABELS,			//Working labels, label store pages and statistics
+	MEMORY_UNDO,			//Undo and redo states
+	MEMORY_IO,				//Buffers of saves and exports in flight
+	MEMORY_GPU,				//Vertex and index buffers uploaded for the model
+	MEMORY_SUBSYSTEM_NUM
+};
+
+const char* memorySubsystemName(MemorySubsystem subsystem);
+
+//Bytes held by each subsystem, with the most each has held and the most held
+//in total. Structures reporting memoryUsage() are followed by a MemoryGauge
+//their owner sets after they change, transient buffers are charged with a
+//MemoryCharge while they live. Safe from any thread.
+void chargeTrackedMemory(MemorySubsystem subsystem, size_t bytes);
+void releaseTrackedMemory(MemorySubsystem subsystem, size_t bytes);
+
+size_t trackedMemory(MemorySubsystem subsystem);
+size_t trackedMemoryPeak(MemorySubsystem subsystem);
+size_t trackedMemoryTotal();
+size_t trackedMemoryTotalPeak();
+
+//Prints every subsystem's bytes and high-water mark
+void printMemoryReport(const char* reason);
+
+//Charges bytes for as long as it lives
+class MemoryCharge {
+public:
+	MemoryCharge(MemorySubsystem subsystem, size_t bytes) :subsystem(subsystem), bytes(bytes) { chargeTrackedMemory(subsystem, bytes); }
+	~MemoryCharge() { releaseTrackedMemory(subsystem, bytes); }
+
+	MemoryCharge(const MemoryCharge&) = delete;
+	MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+private:
+	MemorySubsystem subsystem;
+	size_t bytes;
+};
+
+//Share of a subsystem that follows one owner's structures, released when the
+//owner goes away
+class MemoryGauge {
+public:
+	MemoryGauge(MemorySubsystem subsystem) :subsystem(subsystem), bytes(0) {}
+	~MemoryGauge() { releaseTrackedMemory(subsystem, bytes); }
+
+	void set(size_t newBytes) {
+		if (newBytes > bytes)
+			chargeTrackedMemory(subsystem, newBytes - bytes);
+		else
+			releaseTrackedMemory(subsystem, bytes - newBytes);
+		bytes = newBytes;
+	}
+
+	MemoryGauge(const MemoryGauge&) = delete;
+	MemoryGauge& operator=(const MemoryGauge&) = delete;
+
+private:
+	MemorySubsystem subsystem;
+	size_t bytes;
+};
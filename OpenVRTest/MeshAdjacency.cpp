@@ -0,0 +1,248 @@
+#include "MeshAdjacency.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+
+namespace {
+
+const uint32_t ADJACENCY_FILE_MAGIC = 0x314a4441;	//"ADJ1"
+const size_t HASH_CHUNK = 1 << 20;
+
+bool validFace(const unsigned int* faces, size_t face, unsigned int vertexNum) {
+	return faces[face] < vertexNum && faces[face + 1] < vertexNum && faces[face + 2] < vertexNum;
+}
+
+//Whether offsets start at 0, never decrease and end at the number of values,
+//and every value is below valueLimit
+bool validCSR(const vector<uint32_t>& offsets, const vector<uint32_t>& values, uint32_t valueLimit) {
+	if (offsets.empty() || offsets.front() != 0 || offsets.back() != values.size())
+		return false;
+	atomic<bool> valid(true);
+	parallelForRange(1, offsets.size(), [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; v++) {
+			if (offsets[v] < offsets[v - 1])
+				valid.store(false, memory_order_relaxed);
+		}
+	});
+	parallelForRange(0, values.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			if (values[i] >= valueLimit)
+				valid.store(false, memory_order_relaxed);
+		}
+	});
+	return valid.load();
+}
+
+//Counts entries per vertex, scans them into offsets and scatters face data
+//into each vertex's range. Faces with an index past vertexNum are left out.
+//Each vertex's range is sorted afterwards since the scatter order depends on
+//thread timing.
+void buildCSR(const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum,
+	bool vertexNeighbours, vector<uint32_t>* offsets, vector<uint32_t>* values)
+{
+	uint32_t entriesPerCorner = (vertexNeighbours) ? 2 : 1;
+	size_t cornerNum = 3 * size_t(faceNum);
+
+	unique_ptr<atomic<uint32_t>[]> cursor(new atomic<uint32_t>[vertexNum + 1]);
+	parallelFor(0, vertexNum + 1, [&](size_t v) { cursor[v].store(0, memory_order_relaxed); });
+
+	parallelFor(0, cornerNum, [&](size_t c) {
+		if (validFace(faces, c - c % 3, vertexNum))
+			cursor[faces[c]].fetch_add(entriesPerCorner, memory_order_relaxed);
+	});
+
+	offsets->resize(vertexNum + 1);
+	parallelFor(0, vertexNum + 1, [&](size_t v) { (*offsets)[v] = cursor[v].load(memory_order_relaxed); });
+	uint32_t total = parallelExclusiveScan(offsets->data(), vertexNum + 1);
+	parallelFor(0, vertexNum + 1, [&](size_t v) { cursor[v].store((*offsets)[v], memory_order_relaxed); });
+
+	values->resize(total);
+	parallelFor(0, cornerNum, [&](size_t c) {
+		unsigned int v = faces[c];
+		size_t corner = c % 3;
+		size_t face = c - corner;
+		if (!validFace(faces, face, vertexNum))
+			return;
+		uint32_t slot = cursor[v].fetch_add(entriesPerCorner, memory_order_relaxed);
+		if (vertexNeighbours) {
+			(*values)[slot] = faces[face + (corner + 1) % 3];
+			(*values)[slot + 1] = faces[face + (corner + 2) % 3];
+		}
+		else
+			(*values)[slot] = uint32_t(face / 3);
+	});
+
+	parallelFor(0, vertexNum, [&](size_t v) {
+		sort(values->begin() + (*offsets)[v], values->begin() + (*offsets)[v + 1]);
+	}, 1024);
+}
+
+}
+
+uint64_t hashIndexBuffer(const unsigned int* faces, unsigned int faceNum) {
+	const uint64_t FNV_OFFSET = 14695981039346656037ull;
+	const uint64_t FNV_PRIME = 1099511628211ull;
+
+	//Fixed size chunks keep the hash independent of the thread count
+	size_t count = 3 * size_t(faceNum);
+	size_t chunkNum = (count + HASH_CHUNK - 1) / HASH_CHUNK;
+	vector<uint64_t> chunkHashes(chunkNum);
+	parallelChunks(0, count, chunkNum, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+		uint64_t hash = FNV_OFFSET;
+		for (size_t i = chunkBegin; i < chunkEnd; i++) {
+			hash ^= faces[i];
+			hash *= FNV_PRIME;
+		}
+		chunkHashes[chunk] = hash;
+	});
+
+	uint64_t hash = FNV_OFFSET ^ count;
+	for (uint64_t h : chunkHashes) {
+		hash ^= h;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+void MeshAdjacency::build(const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum, bool withFaces) {
+	auto start = chrono::high_resolution_clock::now();
+
+	atomic<size_t> invalidFaces(0);
+	parallelFor(0, faceNum, [&](size_t face) {
+		if (!validFace(faces, 3 * face, vertexNum))
+			invalidFaces.fetch_add(1, memory_order_relaxed);
+	});
+	if (invalidFaces.load() > 0)
+		printf("MeshAdjacency::build - Skipping %zu faces with indices past %u vertices\n", invalidFaces.load(), vertexNum);
+
+	//Every corner contributes both of its edges, so each interior edge is
+	//seen twice per endpoint
+	vector<uint32_t> halfEdgeOffsets, halfEdges;
+	buildCSR(faces, faceNum, vertexNum, true, &halfEdgeOffsets, &halfEdges);
+
+	//Count unique neighbours, then compact into the final arrays
+	offsets.resize(vertexNum + 1);
+	parallelFor(0, vertexNum, [&](size_t v) {
+		auto first = halfEdges.begin() + halfEdgeOffsets[v];
+		auto last = unique(first, halfEdges.begin() + halfEdgeOffsets[v + 1]);
+		offsets[v] = uint32_t((last - first) - count(first, last, uint32_t(v)));
+	}, 1024);
+	offsets[vertexNum] = 0;
+	uint32_t total = parallelExclusiveScan(offsets.data(), vertexNum + 1);
+
+	//The unique entries sit at the front of each half edge range
+	neighbours.resize(total);
+	parallelFor(0, vertexNum, [&](size_t v) {
+		uint32_t written = offsets[v];
+		for (uint32_t i = halfEdgeOffsets[v]; written < offsets[v + 1]; i++) {
+			if (halfEdges[i] != v)
+				neighbours[written++] = halfEdges[i];
+		}
+	}, 1024);
+
+	if (withFaces)
+		buildCSR(faces, faceNum, vertexNum, false, &faceOffsets, &vertexFaces);
+	else {
+		faceOffsets.clear();
+		vertexFaces.clear();
+	}
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("MeshAdjacency::build - %u vertices, %zu neighbours in %.3f s (%.1f MB)\n",
+		vertexNum, neighbours.size(), seconds, double(memoryUsage()) / (1024.0*1024.0));
+}
+
+bool MeshAdjacency::save(string filename, const unsigned int* faces, unsigned int faceNum) const {
+	ofstream f(filename.c_str(), ios::binary);
+	if (!f.is_open()) {
+		printf("MeshAdjacency::save - File %s could not be opened\n", filename.c_str());
+		return false;
+	}
+
+	uint32_t header[4] = { ADJACENCY_FILE_MAGIC, uint32_t(vertexCount()), faceNum, uint32_t(hasFaces()) };
+	uint64_t hash = hashIndexBuffer(faces, faceNum);
+	uint32_t sizes[2] = { uint32_t(neighbours.size()), uint32_t(vertexFaces.size()) };
+	f.write(reinterpret_cast<const char*>(header), sizeof(header));
+	f.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+	f.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+	f.write(reinterpret_cast<const char*>(offsets.data()), offsets.size()*sizeof(uint32_t));
+	f.write(reinterpret_cast<const char*>(neighbours.data()), neighbours.size()*sizeof(uint32_t));
+	f.write(reinterpret_cast<const char*>(faceOffsets.data()), faceOffsets.size()*sizeof(uint32_t));
+	f.write(reinterpret_cast<const char*>(vertexFaces.data()), vertexFaces.size()*sizeof(uint32_t));
+
+	return f.good();
+}
+
+bool MeshAdjacency::load(string filename, const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum, bool withFaces) {
+	ifstream f(filename.c_str(), ios::binary);
+	if (!f.is_open())
+		return false;
+
+	uint32_t header[4];
+	uint64_t hash;
+	uint32_t sizes[2];
+	f.read(reinterpret_cast<char*>(header), sizeof(header));
+	f.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+	f.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+	if (!f.good()
+		|| header[0] != ADJACENCY_FILE_MAGIC
+		|| header[1] != vertexNum
+		|| header[2] != faceNum
+		|| (withFaces && !header[3])
+		|| sizes[0] > 6 * size_t(faceNum)
+		|| sizes[1] > 3 * size_t(faceNum)
+		|| hash != hashIndexBuffer(faces, faceNum))
+	{
+		printf("MeshAdjacency::load - %s is out of date\n", filename.c_str());
+		return false;
+	}
+
+	offsets.resize(vertexNum + 1);
+	neighbours.resize(sizes[0]);
+	f.read(reinterpret_cast<char*>(offsets.data()), offsets.size()*sizeof(uint32_t));
+	f.read(reinterpret_cast<char*>(neighbours.data()), neighbours.size()*sizeof(uint32_t));
+	if (header[3] && withFaces) {
+		faceOffsets.resize(vertexNum + 1);
+		vertexFaces.resize(sizes[1]);
+		f.read(reinterpret_cast<char*>(faceOffsets.data()), faceOffsets.size()*sizeof(uint32_t));
+		f.read(reinterpret_cast<char*>(vertexFaces.data()), vertexFaces.size()*sizeof(uint32_t));
+	}
+	else {
+		faceOffsets.clear();
+		vertexFaces.clear();
+	}
+
+	//A corrupt cache would index out of bounds later, so it is rebuilt instead
+	if (!f.good() || !validCSR(offsets, neighbours, vertexNum)
+		|| (hasFaces() && !validCSR(faceOffsets, vertexFaces, faceNum)))
+	{
+		printf("MeshAdjacency::load - %s is truncated or corrupt\n", filename.c_str());
+		offsets.clear();
+		neighbours.clear();
+		faceOffsets.clear();
+		vertexFaces.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void MeshAdjacency::buildCached(string cacheFilename,
+	const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum, bool withFaces)
+{
+	if (load(cacheFilename, faces, faceNum, vertexNum, withFaces)) {
+		printf("MeshAdjacency::buildCached - Loaded %s\n", cacheFilename.c_str());
+		return;
+	}
+
+	build(faces, faceNum, vertexNum, withFaces);
+	if (!save(cacheFilename, faces, faceNum))
+		printf("MeshAdjacency::buildCached - Could not write %s\n", cacheFilename.c_str());
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+//Vertex to vertex adjacency of an indexed triangle mesh in compressed sparse
+//row form. The neighbours of vertex v are neighbours[offsets[v]] up to but
+//not including neighbours[offsets[v + 1]], sorted by index. Vertex to face
+//adjacency is stored the same way in faceOffsets and vertexFaces when it is
+//requested, since it roughly doubles the footprint.
+struct MeshAdjacency {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> neighbours;
+
+	std::vector<uint32_t> faceOffsets;
+	std::vector<uint32_t> vertexFaces;
+
+	//Builds with a parallel count, prefix sum and scatter over the faces. Faces
+	//with an index past vertexNum are skipped.
+	void build(const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum, bool withFaces = false);
+
+	//Loads from cacheFilename if it was written for the same index buffer and
+	//is intact, otherwise builds and writes the cache
+	void buildCached(std::string cacheFilename,
+		const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum, bool withFaces = false);
+
+	bool save(std::string filename, const unsigned int* faces, unsigned int faceNum) const;
+	bool load(std::string filename, const unsigned int* faces, unsigned int faceNum, unsigned int vertexNum, bool withFaces);
+
+	size_t vertexCount() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+	const uint32_t* begin(uint32_t v) const { return neighbours.data() + offsets[v]; }
+	const uint32_t* end(uint32_t v) const { return neighbours.data() + offsets[v + 1]; }
+	uint32_t degree(uint32_t v) const { return offsets[v + 1] - offsets[v]; }
+
+	bool hasFaces() const { return !faceOffsets.empty(); }
+	const uint32_t* facesBegin(uint32_t v) const { return vertexFaces.data() + faceOffsets[v]; }
+	const uint32_t* facesEnd(uint32_t v) const { return vertexFaces.data() + faceOffsets[v + 1]; }
+
+	size_t memoryUsage() const {
+		return sizeof(uint32_t)*(offsets.capacity() + neighbours.capacity()
+			+ faceOffsets.capacity() + vertexFaces.capacity());
+	}
+};
+
+//Hash of an index buffer, used to validate cached data
+uint64_t hashIndexBuffer(const unsigned int* faces, unsigned int faceNum);
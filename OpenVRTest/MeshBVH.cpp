@@ -0,0 +1,475 @@
+#include "MeshBVH.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define MESHBVH_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace glm;
+using namespace std;
+
+const float DETERMINANT_EPSILON = 1e-20f;
+
+bool intersectTriangle(vec3 origin, vec3 direction, vec3 a, vec3 b, vec3 c, float* t, float* u, float* v) {
+	vec3 e1 = b - a;
+	vec3 e2 = c - a;
+	vec3 pvec = cross(direction, e2);
+	float det = dot(e1, pvec);
+	if (std::abs(det) < DETERMINANT_EPSILON)
+		return false;
+	float invDet = 1.f / det;
+
+	vec3 tvec = origin - a;
+	*u = dot(tvec, pvec)*invDet;
+	if (*u < 0.f || *u > 1.f)
+		return false;
+
+	vec3 qvec = cross(tvec, e1);
+	*v = dot(direction, qvec)*invDet;
+	if (*v < 0.f || *u + *v > 1.f)
+		return false;
+
+	*t = dot(e2, qvec)*invDet;
+	return *t >= 0.f;
+}
+
+////////////////////////////////////////////
+// Construction
+////////////////////////////////////////////
+namespace {
+
+const int BIN_NUM = 12;
+const unsigned int LEAF_SIZE = 4;			//Always make a leaf at or below one block
+const unsigned int MAX_LEAF_SIZE = 16;		//Never make a leaf above four blocks unless splitting fails
+const int MAX_DEPTH = 100;
+const unsigned int PARALLEL_THRESHOLD = 50000;	//Build both children on separate threads above this many faces
+const float TRAVERSAL_COST = 1.f;
+
+struct Bounds {
+	vec3 min;
+	vec3 max;
+	Bounds() :min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max()) {}
+	void grow(vec3 p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const Bounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	float area() const {
+		if (max.x < min.x) return 0.f;
+		vec3 d = max - min;
+		return 2.f*(d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+};
+
+struct BuildData {
+	const vec3* positions;
+	const unsigned int* faces;
+	vector<Bounds> faceBounds;
+	vector<vec3> centroids;
+	vector<unsigned int> refs;		//Face order, partitioned in place during the build
+	int parallelDepth;
+};
+
+//Leaves temporarily store their face range in firstBlock/blockNum until
+//the blocks are packed
+void appendSubtree(vector<MeshBVH::Node>& nodes, const vector<MeshBVH::Node>& subtree) {
+	int offset = nodes.size();
+	for (MeshBVH::Node n : subtree) {
+		if (!n.isLeaf()) {
+			n.left += offset;
+			n.right += offset;
+		}
+		nodes.push_back(n);
+	}
+}
+
+int buildNode(BuildData& data, unsigned int begin, unsigned int end, int depth, vector<MeshBVH::Node>& nodes) {
+	Bounds bounds, centroidBounds;
+	for (unsigned int i = begin; i < end; i++) {
+		bounds.grow(data.faceBounds[data.refs[i]]);
+		centroidBounds.grow(data.centroids[data.refs[i]]);
+	}
+
+	int index = nodes.size();
+	MeshBVH::Node node;
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+	node.left = -1;
+	node.right = -1;
+	node.firstBlock = begin;
+	node.blockNum = end - begin;
+	nodes.push_back(node);
+
+	unsigned int count = end - begin;
+	if (count <= LEAF_SIZE || depth >= MAX_DEPTH)
+		return index;
+
+	//Binned SAH over the centroid bounds
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestBin = 0;
+	vec3 extent = centroidBounds.max - centroidBounds.min;
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] <= 0.f)
+			continue;
+
+		Bounds binBounds[BIN_NUM];
+		unsigned int binCount[BIN_NUM] = {};
+		float scale = float(BIN_NUM) / extent[axis];
+		for (unsigned int i = begin; i < end; i++) {
+			unsigned int f = data.refs[i];
+			int bin = std::min(BIN_NUM - 1, int((data.centroids[f][axis] - centroidBounds.min[axis])*scale));
+			binCount[bin]++;
+			binBounds[bin].grow(data.faceBounds[f]);
+		}
+
+		float rightArea[BIN_NUM];
+		unsigned int rightCount[BIN_NUM];
+		Bounds accumulated;
+		unsigned int accumulatedCount = 0;
+		for (int b = BIN_NUM - 1; b > 0; b--) {
+			accumulated.grow(binBounds[b]);
+			accumulatedCount += binCount[b];
+			rightArea[b] = accumulated.area();
+			rightCount[b] = accumulatedCount;
+		}
+
+		accumulated = Bounds();
+		accumulatedCount = 0;
+		for (int b = 0; b < BIN_NUM - 1; b++) {
+			accumulated.grow(binBounds[b]);
+			accumulatedCount += binCount[b];
+			float cost = accumulated.area()*accumulatedCount + rightArea[b + 1] * rightCount[b + 1];
+			if (accumulatedCount > 0 && rightCount[b + 1] > 0 && cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	unsigned int* first = data.refs.data() + begin;
+	unsigned int* last = data.refs.data() + end;
+	unsigned int* middle = nullptr;
+	float leafCost = bounds.area()*count;
+	float splitCost = TRAVERSAL_COST*bounds.area() + bestCost;
+
+	if (bestAxis >= 0 && (splitCost < leafCost || count > MAX_LEAF_SIZE)) {
+		float scale = float(BIN_NUM) / extent[bestAxis];
+		float minCentroid = centroidBounds.min[bestAxis];
+		middle = std::partition(first, last, [&](unsigned int f) {
+			int bin = std::min(BIN_NUM - 1, int((data.centroids[f][bestAxis] - minCentroid)*scale));
+			return bin <= bestBin;
+		});
+	}
+	else if (count > MAX_LEAF_SIZE) {
+		//All centroids coincide, split the range in half
+		middle = first + count / 2;
+	}
+	else
+		return index;
+
+	unsigned int mid = begin + static_cast<unsigned int>(middle - first);
+
+	if (count > PARALLEL_THRESHOLD && depth < data.parallelDepth) {
+		vector<MeshBVH::Node> leftNodes, rightNodes;
+		thread leftThread([&]() { buildNode(data, begin, mid, depth + 1, leftNodes); });
+		buildNode(data, mid, end, depth + 1, rightNodes);
+		leftThread.join();
+
+		nodes[index].left = nodes.size();
+		appendSubtree(nodes, leftNodes);
+		nodes[index].right = nodes.size();
+		appendSubtree(nodes, rightNodes);
+	}
+	else {
+		int left = buildNode(data, begin, mid, depth + 1, nodes);
+		int right = buildNode(data, mid, end, depth + 1, nodes);
+		nodes[index].left = left;
+		nodes[index].right = right;
+	}
+
+	return index;
+}
+
+}
+
+void MeshBVH::build(const vec3* positions, const unsigned int* faces, unsigned int faceNum) {
+	nodes.clear();
+	blocks.clear();
+	if (faceNum == 0)
+		return;
+
+	auto start = chrono::high_resolution_clock::now();
+
+	BuildData data;
+	data.positions = positions;
+	data.faces = faces;
+	data.faceBounds.resize(faceNum);
+	data.centroids.resize(faceNum);
+	data.refs.resize(faceNum);
+	data.parallelDepth = 0;
+	for (unsigned int t = workerThreadCount(); t > 1; t /= 2)
+		data.parallelDepth++;
+
+	parallelFor(0, faceNum, [&](size_t f) {
+		Bounds b;
+		b.grow(positions[faces[3 * f]]);
+		b.grow(positions[faces[3 * f + 1]]);
+		b.grow(positions[faces[3 * f + 2]]);
+		data.faceBounds[f] = b;
+		data.centroids[f] = (b.min + b.max)*0.5f;
+		data.refs[f] = f;
+	});
+
+	nodes.reserve(2 * faceNum / LEAF_SIZE);
+	buildNode(data, 0, faceNum, 0, nodes);
+
+	//Assign blocks to leaves, then pack the triangles of each leaf in parallel
+	vector<unsigned int> leafFirstFace(nodes.size());
+	vector<unsigned int> leafFaceNum(nodes.size());
+	unsigned int blockTotal = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		Node& n = nodes[i];
+		if (!n.isLeaf()) continue;
+		leafFirstFace[i] = n.firstBlock;
+		leafFaceNum[i] = n.blockNum;
+		n.firstBlock = blockTotal;
+		n.blockNum = (leafFaceNum[i] + 3) / 4;
+		blockTotal += n.blockNum;
+	}
+
+	blocks.resize(blockTotal);
+	parallelFor(0, nodes.size(), [&](size_t i) {
+		const Node& n = nodes[i];
+		if (!n.isLeaf()) return;
+		for (unsigned int b = 0; b < n.blockNum; b++) {
+			TriangleBlock& block = blocks[n.firstBlock + b];
+			for (unsigned int lane = 0; lane < 4; lane++) {
+				unsigned int local = 4 * b + lane;
+				int face = -1;
+				vec3 v0(0.f), e1(0.f), e2(0.f);
+				if (local < leafFaceNum[i]) {
+					face = data.refs[leafFirstFace[i] + local];
+					v0 = positions[faces[3 * face]];
+					e1 = positions[faces[3 * face + 1]] - v0;
+					e2 = positions[faces[3 * face + 2]] - v0;
+				}
+				for (int axis = 0; axis < 3; axis++) {
+					block.v0[axis][lane] = v0[axis];
+					block.e1[axis][lane] = e1[axis];
+					block.e2[axis][lane] = e2[axis];
+				}
+				block.id[lane] = face;
+			}
+		}
+	}, 1024);
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("MeshBVH::build - %u faces, %zu nodes, %zu blocks in %.3f s\n",
+		faceNum, nodes.size(), blocks.size(), seconds);
+}
+
+////////////////////////////////////////////
+// Traversal
+////////////////////////////////////////////
+namespace {
+
+bool intersectBounds(vec3 boundsMin, vec3 boundsMax, vec3 origin, vec3 invDirection, float maxT, float* entry) {
+	vec3 t0 = (boundsMin - origin)*invDirection;
+	vec3 t1 = (boundsMax - origin)*invDirection;
+	vec3 tNear = glm::min(t0, t1);
+	vec3 tFar = glm::max(t0, t1);
+	float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+	float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+	*entry = tEnter;
+	return tEnter <= tExit;
+}
+
+float safeInverse(float x) {
+	const float TINY = 1e-30f;
+	if (std::abs(x) < TINY)
+		x = (x < 0.f) ? -TINY : TINY;
+	return 1.f / x;
+}
+
+}
+
+void MeshBVH::intersectBlock(const TriangleBlock& block, vec3 origin, vec3 direction, RayHit* hit) const {
+#ifdef MESHBVH_SSE
+	__m128 dx = _mm_set1_ps(direction.x);
+	__m128 dy = _mm_set1_ps(direction.y);
+	__m128 dz = _mm_set1_ps(direction.z);
+
+	__m128 e1x = _mm_load_ps(block.e1[0]);
+	__m128 e1y = _mm_load_ps(block.e1[1]);
+	__m128 e1z = _mm_load_ps(block.e1[2]);
+	__m128 e2x = _mm_load_ps(block.e2[0]);
+	__m128 e2y = _mm_load_ps(block.e2[1]);
+	__m128 e2z = _mm_load_ps(block.e2[2]);
+
+	//pvec = cross(direction, e2)
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+	//tvec = origin - v0
+	__m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_load_ps(block.v0[0]));
+	__m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_load_ps(block.v0[1]));
+	__m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_load_ps(block.v0[2]));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+	//qvec = cross(tvec, e1)
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+	__m128 valid = _mm_cmpgt_ps(absDet, _mm_set1_ps(DETERMINANT_EPSILON));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+	valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(hit->t)));
+
+	int mask = _mm_movemask_ps(valid);
+	if (mask == 0)
+		return;
+
+	alignas(16) float tLanes[4], uLanes[4], vLanes[4];
+	_mm_store_ps(tLanes, t);
+	_mm_store_ps(uLanes, u);
+	_mm_store_ps(vLanes, v);
+	for (int lane = 0; lane < 4; lane++) {
+		if ((mask & (1 << lane)) && tLanes[lane] < hit->t) {
+			hit->triangle = block.id[lane];
+			hit->t = tLanes[lane];
+			hit->u = uLanes[lane];
+			hit->v = vLanes[lane];
+		}
+	}
+#else
+	for (int lane = 0; lane < 4; lane++) {
+		if (block.id[lane] < 0)
+			continue;
+		vec3 v0(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+		vec3 e1(block.e1[0][lane], block.e1[1][lane], block.e1[2][lane]);
+		vec3 e2(block.e2[0][lane], block.e2[1][lane], block.e2[2][lane]);
+		float t, u, v;
+		if (intersectTriangle(origin, direction, v0, v0 + e1, v0 + e2, &t, &u, &v) && t < hit->t) {
+			hit->triangle = block.id[lane];
+			hit->t = t;
+			hit->u = u;
+			hit->v = v;
+		}
+	}
+#endif
+}
+
+RayHit MeshBVH::intersect(vec3 origin, vec3 direction, float maxT) const {
+	RayHit hit;
+	hit.t = maxT;
+	if (nodes.empty())
+		return hit;
+
+	vec3 invDirection(safeInverse(direction.x), safeInverse(direction.y), safeInverse(direction.z));
+
+	const int STACK_SIZE = MAX_DEPTH + 28;
+	int stack[STACK_SIZE];
+	int stackSize = 0;
+
+	float entry;
+	if (!intersectBounds(nodes[0].boundsMin, nodes[0].boundsMax, origin, invDirection, hit.t, &entry))
+		return hit;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = nodes[stack[--stackSize]];
+
+		if (node.isLeaf()) {
+			for (unsigned int b = 0; b < node.blockNum; b++)
+				intersectBlock(blocks[node.firstBlock + b], origin, direction, &hit);
+			continue;
+		}
+
+		float leftEntry, rightEntry;
+		const Node& left = nodes[node.left];
+		const Node& right = nodes[node.right];
+		bool hitLeft = intersectBounds(left.boundsMin, left.boundsMax, origin, invDirection, hit.t, &leftEntry);
+		bool hitRight = intersectBounds(right.boundsMin, right.boundsMax, origin, invDirection, hit.t, &rightEntry);
+
+		//Push the far child first so the near child is visited next
+		if (hitLeft && hitRight) {
+			if (leftEntry < rightEntry) {
+				stack[stackSize++] = node.right;
+				stack[stackSize++] = node.left;
+			}
+			else {
+				stack[stackSize++] = node.left;
+				stack[stackSize++] = node.right;
+			}
+		}
+		else if (hitLeft)
+			stack[stackSize++] = node.left;
+		else if (hitRight)
+			stack[stackSize++] = node.right;
+	}
+
+	if (!hit.hit())
+		hit.t = std::numeric_limits<float>::max();
+
+	return hit;
+}
+
+void MeshBVH::intersect(const vec3* origins, const vec3* directions, RayHit* hits, size_t rayNum) const {
+	parallelFor(0, rayNum, [&](size_t i) {
+		hits[i] = intersect(origins[i], directions[i]);
+	}, 256);
+}
+
+double benchmarkRayCasts(const MeshBVH& bvh, const vec3* positions, size_t pointNum, size_t rayNum) {
+	if (bvh.empty() || pointNum == 0 || rayNum == 0)
+		return 0.0;
+
+	vec3 center = (bvh.boundsMin() + bvh.boundsMax())*0.5f;
+	float radius = 0.5f*length(bvh.boundsMax() - bvh.boundsMin());
+
+	mt19937 rng(1234);
+	uniform_real_distribution<float> uniform(-1.f, 1.f);
+	uniform_int_distribution<size_t> pickVertex(0, pointNum - 1);
+
+	vector<vec3> origins(rayNum);
+	vector<vec3> directions(rayNum);
+	vector<RayHit> hits(rayNum);
+	for (size_t i = 0; i < rayNum; i++) {
+		vec3 offset;
+		do {
+			offset = vec3(uniform(rng), uniform(rng), uniform(rng));
+		} while (dot(offset, offset) > 1.f || dot(offset, offset) < 1e-6f);
+		origins[i] = center + normalize(offset)*radius;
+		directions[i] = normalize(positions[pickVertex(rng)] - origins[i] + vec3(1e-6f));
+	}
+
+	auto start = chrono::high_resolution_clock::now();
+	bvh.intersect(origins.data(), directions.data(), hits.data(), rayNum);
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+	size_t hitNum = 0;
+	for (const RayHit& h : hits)
+		hitNum += h.hit();
+
+	double raysPerSecond = double(rayNum) / std::max(seconds, 1e-9);
+	printf("MeshBVH::benchmark - %zu rays (%zu hits) in %.3f s, %.2f Mrays/s on %u threads\n",
+		rayNum, hitNum, seconds, raysPerSecond*1e-6, workerThreadCount());
+
+	return raysPerSecond;
+}
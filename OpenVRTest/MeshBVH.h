@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <glm/glm.hpp>
+
+struct RayHit {
+	int triangle;		//Index of the hit face in the index buffer, -1 if nothing was hit
+	float t;			//Distance along the ray direction
+	float u, v;			//Barycentric coordinates of the hit relative to the face's second and third vertices
+
+	RayHit() :triangle(-1), t(std::numeric_limits<float>::max()), u(0.f), v(0.f) {}
+	bool hit() const { return triangle >= 0; }
+};
+
+//Moller-Trumbore ray/triangle test. Returns true and writes t, u and v if the
+//ray hits triangle abc in front of the origin
+bool intersectTriangle(glm::vec3 origin, glm::vec3 direction,
+	glm::vec3 a, glm::vec3 b, glm::vec3 c, float* t, float* u, float* v);
+
+//Bounding volume hierarchy over the faces of an indexed triangle mesh, built
+//with a binned surface area heuristic. Leaf triangles are stored as blocks of
+//four so a ray is tested against a whole block at once with SSE.
+class MeshBVH {
+public:
+	struct Node {
+		glm::vec3 boundsMin;
+		int left;					//Child node indices, -1 for leaves
+		glm::vec3 boundsMax;
+		int right;
+		unsigned int firstBlock;	//Triangle blocks of a leaf
+		unsigned int blockNum;
+
+		bool isLeaf() const { return left < 0; }
+	};
+
+	//Precomputed Moller-Trumbore data for four triangles in SoA layout
+	struct alignas(16) TriangleBlock {
+		float v0[3][4];
+		float e1[3][4];
+		float e2[3][4];
+		int id[4];			//Face index, -1 for padding
+	};
+
+	MeshBVH() {}
+
+	void build(const glm::vec3* positions, const unsigned int* faces, unsigned int faceNum);
+
+	//Closest hit along the ray within [0, maxT)
+	RayHit intersect(glm::vec3 origin, glm::vec3 direction,
+		float maxT = std::numeric_limits<float>::max()) const;
+
+	//Traces rayNum rays split across worker threads
+	void intersect(const glm::vec3* origins, const glm::vec3* directions, RayHit* hits, size_t rayNum) const;
+
+	bool empty() const { return nodes.empty(); }
+	size_t nodeCount() const { return nodes.size(); }
+	size_t blockCount() const { return blocks.size(); }
+	size_t memoryUsage() const { return nodes.capacity()*sizeof(Node) + blocks.capacity()*sizeof(TriangleBlock); }
+	glm::vec3 boundsMin() const { return nodes.empty() ? glm::vec3(0.f) : nodes[0].boundsMin; }
+	glm::vec3 boundsMax() const { return nodes.empty() ? glm::vec3(0.f) : nodes[0].boundsMax; }
+
+private:
+	std::vector<Node> nodes;
+	std::vector<TriangleBlock> blocks;
+
+	void intersectBlock(const TriangleBlock& block, glm::vec3 origin, glm::vec3 direction, RayHit* hit) const;
+};
+
+//Casts rayNum random rays from the bounding sphere of the mesh towards random
+//vertices and returns the number of rays traced per second
+double benchmarkRayCasts(const MeshBVH& bvh, const glm::vec3* positions, size_t pointNum, size_t rayNum = 1000000);
@@ -0,0 +1,238 @@
+#include "MeshWeld.h"
+#include "ParallelFor.h"
+#include "UnionFind.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+struct GridCell {
+	int64_t x, y, z;
+};
+
+size_t hashCell(GridCell c, size_t mask) {
+	uint64_t h = uint64_t(c.x)*73856093ull ^ uint64_t(c.y)*19349663ull ^ uint64_t(c.z)*83492791ull;
+	return size_t(h ^ (h >> 29)) & mask;
+}
+
+//Hash grid over the vertices in compressed sparse row form. Cells that hash
+//to the same bucket share it, so lookups still check distances.
+struct WeldGrid {
+	float cellSize;
+	vec3 origin;
+	size_t mask;
+	vector<uint32_t> offsets;
+	vector<uint32_t> vertices;
+
+	GridCell cell(vec3 p) const {
+		vec3 offset = p - origin;
+		return{ int64_t(floor(double(offset.x) / cellSize)), int64_t(floor(double(offset.y) / cellSize)),
+			int64_t(floor(double(offset.z) / cellSize)) };
+	}
+
+	void build(const vec3* positions, size_t vertexNum) {
+		size_t bucketNum = 1;
+		while (bucketNum < vertexNum)
+			bucketNum *= 2;
+		mask = bucketNum - 1;
+
+		vector<uint32_t> bucket(vertexNum);
+		unique_ptr<atomic<uint32_t>[]> cursor(new atomic<uint32_t>[bucketNum + 1]);
+		parallelFor(0, bucketNum + 1, [&](size_t b) { cursor[b].store(0, memory_order_relaxed); });
+		parallelFor(0, vertexNum, [&](size_t v) {
+			bucket[v] = uint32_t(hashCell(cell(positions[v]), mask));
+			cursor[bucket[v]].fetch_add(1, memory_order_relaxed);
+		});
+
+		offsets.resize(bucketNum + 1);
+		parallelFor(0, bucketNum + 1, [&](size_t b) { offsets[b] = cursor[b].load(memory_order_relaxed); });
+		parallelExclusiveScan(offsets.data(), bucketNum + 1);
+		parallelFor(0, bucketNum + 1, [&](size_t b) { cursor[b].store(offsets[b], memory_order_relaxed); });
+
+		vertices.resize(vertexNum);
+		parallelFor(0, vertexNum, [&](size_t v) {
+			vertices[cursor[bucket[v]].fetch_add(1, memory_order_relaxed)] = uint32_t(v);
+		});
+		parallelFor(0, bucketNum, [&](size_t b) {
+			sort(vertices.begin() + offsets[b], vertices.begin() + offsets[b + 1]);
+		}, 1024);
+	}
+};
+
+}
+
+float weldEpsilon(const vector<vec3>& positions) {
+	if (positions.empty())
+		return 0.f;
+	vec3 boundsMin = positions[0];
+	vec3 boundsMax = positions[0];
+	for (const vec3& p : positions) {
+		boundsMin = min(boundsMin, p);
+		boundsMax = max(boundsMax, p);
+	}
+	return length(boundsMax - boundsMin)*WELD_RELATIVE_EPSILON;
+}
+
+size_t weldVertices(float epsilon, vector<vec3>* positions, vector<vec3>* normals,
+	vector<unsigned int>* indices, vector<uint32_t>* remap)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	size_t vertexNum = positions->size();
+	remap->resize(vertexNum);
+	if (!(epsilon > 0.f) || !isfinite(epsilon) || vertexNum == 0) {
+		printf("weldVertices - Invalid weld distance %g, mesh left unchanged\n", epsilon);
+		parallelFor(0, vertexNum, [&](size_t v) { (*remap)[v] = uint32_t(v); });
+		return 0;
+	}
+
+	WeldGrid grid;
+	grid.cellSize = epsilon;
+	grid.origin = (*positions)[0];
+	for (const vec3& p : *positions)
+		grid.origin = min(grid.origin, p);
+	grid.build(positions->data(), vertexNum);
+
+	//Join every pair closer than epsilon. Such pairs are at most one cell apart.
+	ConcurrentUnionFind sets(vertexNum);
+	float epsilonSquared = epsilon*epsilon;
+	parallelFor(0, vertexNum, [&](size_t v) {
+		vec3 p = (*positions)[v];
+		GridCell c = grid.cell(p);
+		size_t visited[27];
+		size_t visitedNum = 0;
+		for (int64_t dx = -1; dx <= 1; dx++) {
+			for (int64_t dy = -1; dy <= 1; dy++) {
+				for (int64_t dz = -1; dz <= 1; dz++) {
+					size_t b = hashCell({ c.x + dx, c.y + dy, c.z + dz }, grid.mask);
+					if (find(visited, visited + visitedNum, b) != visited + visitedNum)
+						continue;
+					visited[visitedNum++] = b;
+					for (uint32_t i = grid.offsets[b]; i < grid.offsets[b + 1]; i++) {
+						uint32_t u = grid.vertices[i];
+						vec3 diff = (*positions)[u] - p;
+						if (u > v && dot(diff, diff) <= epsilonSquared)
+							sets.unite(uint32_t(v), u);
+					}
+				}
+			}
+		}
+	}, 1024);
+
+	//Number the groups by their lowest vertex
+	vector<uint32_t> newIndex(vertexNum + 1, 0);
+	parallelFor(0, vertexNum, [&](size_t v) {
+		(*remap)[v] = sets.find(uint32_t(v));
+		newIndex[v] = ((*remap)[v] == v) ? 1 : 0;
+	});
+	uint32_t weldedNum = parallelExclusiveScan(newIndex.data(), vertexNum + 1);
+	parallelFor(0, vertexNum, [&](size_t v) { (*remap)[v] = newIndex[(*remap)[v]]; });
+
+	vector<vec3> weldedPositions(weldedNum);
+	parallelFor(0, vertexNum, [&](size_t v) {
+		if (newIndex[v] != newIndex[v + 1])
+			weldedPositions[newIndex[v]] = (*positions)[v];
+	});
+
+	//Average the normals of each group. Groups of one keep their normal as is.
+	bool hasNormals = normals->size() == vertexNum;
+	vector<vec3> weldedNormals(weldedNum, vec3(0.f));
+	vector<unsigned char> recompute(weldedNum, (hasNormals) ? 0 : 1);
+	if (hasNormals) {
+		vector<uint32_t> groupSize(weldedNum, 0);
+		for (size_t v = 0; v < vertexNum; v++) {
+			weldedNormals[(*remap)[v]] += (*normals)[v];
+			groupSize[(*remap)[v]]++;
+		}
+		parallelFor(0, weldedNum, [&](size_t v) {
+			if (groupSize[v] < 2)
+				return;
+			float len = length(weldedNormals[v]);
+			if (len > 1e-4f*groupSize[v])
+				weldedNormals[v] /= len;
+			else
+				recompute[v] = 1;
+		});
+	}
+
+	//Drop faces with a repeated corner or zero area
+	size_t faceNum = indices->size() / 3;
+	float minCrossSquared = epsilonSquared*epsilonSquared;
+	vector<uint32_t> keep(faceNum + 1, 0);
+	parallelFor(0, faceNum, [&](size_t f) {
+		unsigned int* face = indices->data() + 3 * f;
+		for (size_t corner = 0; corner < 3; corner++)
+			face[corner] = (*remap)[face[corner]];
+		if (face[0] == face[1] || face[1] == face[2] || face[2] == face[0])
+			return;
+		vec3 n = cross(weldedPositions[face[1]] - weldedPositions[face[0]], weldedPositions[face[2]] - weldedPositions[face[0]]);
+		keep[f] = (dot(n, n) > minCrossSquared) ? 1 : 0;
+	});
+	uint32_t keptNum = parallelExclusiveScan(keep.data(), faceNum + 1);
+
+	vector<unsigned int> weldedIndices(3 * size_t(keptNum));
+	parallelFor(0, faceNum, [&](size_t f) {
+		if (keep[f] == keep[f + 1])
+			return;
+		for (size_t corner = 0; corner < 3; corner++)
+			weldedIndices[3 * size_t(keep[f]) + corner] = (*indices)[3 * f + corner];
+	});
+
+	//Area weighted face normals where the averages were unusable
+	size_t recomputeNum = 0;
+	for (unsigned char r : recompute)
+		recomputeNum += r;
+	if (recomputeNum > 0) {
+		vector<vec3> faceSums(weldedNum, vec3(0.f));
+		for (size_t f = 0; f < keptNum; f++) {
+			const unsigned int* face = weldedIndices.data() + 3 * f;
+			vec3 n = cross(weldedPositions[face[1]] - weldedPositions[face[0]], weldedPositions[face[2]] - weldedPositions[face[0]]);
+			for (size_t corner = 0; corner < 3; corner++) {
+				if (recompute[face[corner]])
+					faceSums[face[corner]] += n;
+			}
+		}
+		parallelFor(0, weldedNum, [&](size_t v) {
+			if (recompute[v] && dot(faceSums[v], faceSums[v]) > 0.f)
+				weldedNormals[v] = normalize(faceSums[v]);
+		});
+	}
+
+	*positions = move(weldedPositions);
+	*normals = move(weldedNormals);
+	*indices = move(weldedIndices);
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	printf("weldVertices - %zu vertices welded into %u, %zu degenerate faces removed, %zu normals recomputed in %.3f s\n",
+		vertexNum, weldedNum, faceNum - keptNum, recomputeNum, seconds);
+
+	return vertexNum - weldedNum;
+}
+
+void remapLabels(const vector<uint32_t>& remap, size_t weldedNum, vector<unsigned char>* labels) {
+	if (labels->size() != remap.size()) {
+		printf("remapLabels - %zu labels don't match the %zu unwelded vertices\n", labels->size(), remap.size());
+		labels->resize(weldedNum, 0);
+		return;
+	}
+
+	//Walk backwards so the lowest vertex of each group writes last
+	vector<unsigned char> welded(weldedNum, 0);
+	for (size_t v = remap.size(); v-- > 0;)
+		welded[remap[v]] = (*labels)[v];
+	*labels = move(welded);
+}
+
+vector<unsigned char> unweldLabels(const vector<uint32_t>& remap, const unsigned char* weldedLabels) {
+	vector<unsigned char> labels(remap.size());
+	parallelFor(0, remap.size(), [&](size_t v) { labels[v] = weldedLabels[remap[v]]; });
+	return labels;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+//Weld distance as a fraction of the bounding box diagonal. Welding is turned
+//on with --weld on the command line.
+constexpr float WELD_RELATIVE_EPSILON = 1e-6f;
+
+//Merges vertices closer than epsilon and removes faces left with a repeated
+//corner or zero area. Vertices are bucketed in a hash grid with cells epsilon
+//wide and nearby pairs are joined with a union-find, so chains of close
+//vertices weld together. Each group keeps the position of its lowest vertex
+//and the new vertices stay in the order of their lowest original index.
+//Normals of a group are averaged, and recomputed from the faces where the
+//average cancels out or the mesh had none.
+//remap receives the new index of every original vertex.
+//Returns the number of vertices removed.
+size_t weldVertices(float epsilon, std::vector<glm::vec3>* positions, std::vector<glm::vec3>* normals,
+	std::vector<unsigned int>* indices, std::vector<uint32_t>* remap);
+
+//Weld distance for a model, from WELD_RELATIVE_EPSILON
+float weldEpsilon(const std::vector<glm::vec3>& positions);
+
+//Labels in a .clr always belong to the unwelded model its header names, so
+//they load and transfer against that model whether or not it was welded.
+
+//Moves per vertex labels of the unwelded model onto the welded vertices. A
+//welded vertex takes the label of its lowest original vertex.
+void remapLabels(const std::vector<uint32_t>& remap, size_t weldedNum, std::vector<unsigned char>* labels);
+
+//Labels of the unwelded model from the labels of the welded vertices, for
+//saving. Every original vertex takes the label of the vertex it welded into.
+std::vector<unsigned char> unweldLabels(const std::vector<uint32_t>& remap, const unsigned char* weldedLabels);
@@ -5,13 +5,45 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <stdlib.h>
+#include <limits.h>
 
 #include "ConvexHull.h"
+#include "LabelTransfer.h"
 
 
 int main(int argc, char** argv)
 {
 	using namespace std;
+
+	//Carry painted labels onto a regenerated model without opening a window
+	//OpenVRTest --transfer old.clr newModel.ply new.clr [k]
+	if (argc >= 5 && string(argv[1]) == "--transfer") {
+		int k = 1;
+		if (argc >= 6) {
+			char* end = nullptr;
+			long parsed = strtol(argv[5], &end, 10);
+			if (end == argv[5] || *end != '\0' || parsed < 1 || parsed > INT_MAX) {
+				printf("Usage: OpenVRTest --transfer old.clr newModel.ply new.clr [k]\n");
+				return 1;
+			}
+			k = int(parsed);
+		}
+		return transferLabelFile(argv[2], argv[3], argv[4], k) ? 0 : 1;
+	}
+
+	//--weld anywhere merges duplicated vertices of the loaded model
+	bool weldOnImport = false;
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--weld") {
+			weldOnImport = true;
+			for (int j = i; j + 1 < argc; j++)
+				argv[j] = argv[j + 1];
+			argc--;
+			i--;
+		}
+	}
+
 	vector<unsigned char> colors = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
 
 	ofstream f("test.txt", ios::binary);
@@ -87,5 +119,5 @@ int main(int argc, char** argv)
 		multisampling = std::stoi(argv[3]);
 	}
 
-	wm.paintingLoopIndexedMT(loadFilename, saveFilename, multisampling);
+	wm.paintingLoopIndexedMT(loadFilename, saveFilename, multisampling, weldOnImport);
 }
\ No newline at end of file
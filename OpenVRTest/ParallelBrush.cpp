@@ -0,0 +1,159 @@
+#include "ParallelBrush.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace glm;
+using namespace std;
+
+void applyBrush(const vector<IndexVec3>& neighbours, unsigned char drawColor, Bitmask visibility,
+	unsigned char* labels, size_t labelNum, UndoStackRef<unsigned char>& undoStack, LabelStore& labelStore,
+	unsigned int threadNum)
+{
+	size_t threads = (threadNum > 0) ? threadNum : workerThreadCount();
+	if (neighbours.size() < PARALLEL_BRUSH_MIN_VERTICES || threads < 2 || labelNum == 0) {
+		for (const IndexVec3& vi : neighbours) {
+			if (visibility.test(labels[vi.index]))
+				continue;
+			undoStack.modify(vi.index, drawColor, labels, visibility);
+			labels[vi.index] = drawColor;
+			labelStore.markChanged(vi.index);
+		}
+		return;
+	}
+
+	//Visible neighbours found by each chunk, bucketed by the range owning them.
+	//Nothing is written until every chunk has read its labels.
+	size_t rangeSize = (labelNum + threads - 1) / threads;
+	vector<vector<vector<size_t>>> buckets(threads, vector<vector<size_t>>(threads));
+	parallelChunks(0, neighbours.size(), threads, [&](size_t chunk, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			size_t index = neighbours[i].index;
+			if (!visibility.test(labels[index]))
+				buckets[chunk][index / rangeSize].push_back(index);
+		}
+	});
+
+	//Each range records and writes its own vertices. A vertex found twice is
+	//painted once, which leaves the same old and new labels.
+	vector<map<size_t, WriteInfo<unsigned char>>> rangeWrites(threads);
+	parallelChunks(0, threads, threads, [&](size_t range, size_t, size_t) {
+		vector<size_t> elements;
+		for (size_t chunk = 0; chunk < threads; chunk++)
+			elements.insert(elements.end(), buckets[chunk][range].begin(), buckets[chunk][range].end());
+		sort(elements.begin(), elements.end());
+		elements.erase(unique(elements.begin(), elements.end()), elements.end());
+
+		auto& writes = rangeWrites[range];
+		for (size_t index : elements) {
+			writes.emplace_hint(writes.end(), index, WriteInfo<unsigned char>(labels[index], drawColor));
+			labels[index] = drawColor;
+		}
+	});
+
+	for (auto& writes : rangeWrites) {
+		for (const auto& it : writes)
+			labelStore.markChanged(it.first);
+		undoStack.mergeWrites(writes);
+	}
+}
+
+bool checkParallelBrush(unsigned int threadNum) {
+	const size_t LABEL_NUM = 4 * PARALLEL_BRUSH_MIN_VERTICES;
+	const unsigned char HIDDEN_LABEL = 3;
+	Bitmask visibility;
+	visibility.toggle(HIDDEN_LABEL);
+
+	vector<unsigned char> initialLabels(LABEL_NUM);
+	for (size_t i = 0; i < LABEL_NUM; i++)
+		initialLabels[i] = (unsigned char)((i * 7919) % 5);
+
+	//Two strokes sharing vertices, each listing some vertices twice and out of order
+	vector<vector<IndexVec3>> strokes(2);
+	for (size_t s = 0; s < strokes.size(); s++) {
+		for (size_t i = 0; i < 2 * PARALLEL_BRUSH_MIN_VERTICES; i++) {
+			size_t index = ((s * LABEL_NUM / 4 + i) * 48271) % LABEL_NUM;
+			strokes[s].emplace_back(index, vec3(0.f));
+			if (i % 10 == 0)
+				strokes[s].emplace_back(index, vec3(0.f));
+		}
+	}
+
+	vector<unsigned char> results[2];
+	map<size_t, WriteInfo<unsigned char>> writes[2];
+	unsigned int threadCounts[2] = { 1, threadNum };
+	for (int run = 0; run < 2; run++) {
+		results[run] = initialLabels;
+		LabelStore store(results[run]);
+		UndoStackRef<unsigned char> undoStack(1);
+		undoStack.startNewState();
+		for (size_t s = 0; s < strokes.size(); s++)
+			applyBrush(strokes[s], (unsigned char)(1 + s), visibility, results[run].data(), LABEL_NUM, undoStack, store, threadCounts[run]);
+		writes[run] = undoStack.getLastState();
+	}
+
+	bool identical = results[0] == results[1] && writes[0].size() == writes[1].size()
+		&& equal(writes[0].begin(), writes[0].end(), writes[1].begin(),
+			[](const pair<const size_t, WriteInfo<unsigned char>>& a, const pair<const size_t, WriteInfo<unsigned char>>& b) {
+				return a.first == b.first && a.second.oldValue == b.second.oldValue && a.second.newValue == b.second.newValue;
+			});
+	if (!identical)
+		printf("checkParallelBrush - %u threads differ from painting on one thread\n", threadNum);
+	return identical;
+}
+
+void benchmarkBrushScaling(VertexIndex& index, const vec3* positions, size_t pointNum, float radius, size_t sampleNum) {
+	if (pointNum == 0 || sampleNum == 0)
+		return;
+	if (checkParallelBrush(std::max(workerThreadCount(), 2u)))
+		printf("benchmarkBrushScaling - parallel brush matches the single threaded brush\n");
+
+	vector<vec3> centers(sampleNum);
+	for (size_t s = 0; s < sampleNum; s++)
+		centers[s] = positions[(s*pointNum) / sampleNum];
+	Bitmask visibility;
+
+	vector<unsigned char> referenceLabels;
+	map<size_t, WriteInfo<unsigned char>> referenceWrites;
+	double referenceSeconds = 0.0;
+	unsigned int maxThreads = workerThreadCount();
+	for (unsigned int threads = 1;; threads = std::min(2 * threads, maxThreads)) {
+		vector<unsigned char> labels(pointNum, 0);
+		LabelStore store(labels);
+		UndoStackRef<unsigned char> undoStack(1);
+		undoStack.startNewState();
+		index.setThreadCount(threads);
+
+		vector<IndexVec3> neighbours;
+		size_t painted = 0;
+		auto start = chrono::high_resolution_clock::now();
+		for (size_t s = 0; s < sampleNum; s++) {
+			neighbours.clear();
+			index.findNeighboursBatch(&centers[s], 1, radius*radius, neighbours);
+			applyBrush(neighbours, (unsigned char)(1 + s % 7), visibility, labels.data(), pointNum, undoStack, store, threads);
+			painted += neighbours.size();
+		}
+		double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+		if (threads == 1) {
+			referenceLabels = labels;
+			referenceWrites = undoStack.getLastState();
+			referenceSeconds = seconds;
+		}
+		const auto& writes = undoStack.getLastState();
+		bool identical = labels == referenceLabels && writes.size() == referenceWrites.size()
+			&& equal(writes.begin(), writes.end(), referenceWrites.begin(),
+				[](const pair<const size_t, WriteInfo<unsigned char>>& a, const pair<const size_t, WriteInfo<unsigned char>>& b) {
+					return a.first == b.first && a.second.oldValue == b.second.oldValue && a.second.newValue == b.second.newValue;
+				});
+
+		printf("benchmarkBrushScaling - %u threads painted %zu vertices in %.3f ms, %.2fx, undo %.1f MB%s\n",
+			threads, painted, seconds*1000.0, referenceSeconds / seconds, double(undoStack.memoryUsage()) / (1024.0*1024.0),
+			(identical) ? "" : ", results differ");
+		if (threads == maxThreads)
+			break;
+	}
+	index.setThreadCount(0);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <glm/glm.hpp>
+#include <Bitmask.h>
+
+#include "VertexIndex.h"
+#include "UndoStack.h"
+#include "LabelStore.h"
+
+//Footprints of at least this many vertices are split across threads
+const size_t PARALLEL_BRUSH_MIN_VERTICES = 65536;
+
+//Paints every neighbour whose label isn't hidden with drawColor, recording
+//each change in the undo stack's last state and marking its page in the
+//store. Large footprints are filtered in parallel, then partitioned by vertex
+//index so each thread builds the undo entries and writes the labels of one
+//range. The labels and undo state come out the same as painting the
+//neighbours one at a time. threadNum of 0 uses one thread per core.
+void applyBrush(const std::vector<IndexVec3>& neighbours, unsigned char drawColor, Bitmask visibility,
+	unsigned char* labels, size_t labelNum, UndoStackRef<unsigned char>& undoStack, LabelStore& labelStore,
+	unsigned int threadNum = 0);
+
+//Paints two overlapping strokes over a synthetic footprint with duplicated
+//neighbours and hidden labels, split across threadNum threads and on one
+//thread, and returns whether the labels and undo writes are identical
+bool checkParallelBrush(unsigned int threadNum = 4);
+
+//Times a query and applyBrush for sampleNum spheres of the given radius
+//around evenly spaced vertices, with 1, 2, 4... threads up to one per core,
+//checks every thread count against the single threaded labels and prints the
+//speedups
+void benchmarkBrushScaling(VertexIndex& index, const glm::vec3* positions, size_t pointNum, float radius, size_t sampleNum);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+//Number of threads used by the parallel loops below
+inline unsigned int workerThreadCount() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//Splits [begin, end) into at most chunkNum contiguous chunks and calls
+//func(chunkIndex, chunkBegin, chunkEnd) for each chunk on its own thread.
+//The calling thread processes chunk 0. Chunk boundaries only depend on the
+//range and chunkNum, so per-chunk results can be combined deterministically.
+template<typename Func>
+void parallelChunks(size_t begin, size_t end, size_t chunkNum, Func func) {
+	if (end <= begin)
+		return;
+	size_t count = end - begin;
+	chunkNum = std::max(size_t(1), std::min(chunkNum, count));
+	size_t chunkSize = (count + chunkNum - 1) / chunkNum;
+	chunkNum = (count + chunkSize - 1) / chunkSize;
+
+	std::vector<std::thread> threads;
+	threads.reserve(chunkNum - 1);
+	for (size_t c = 1; c < chunkNum; c++) {
+		size_t chunkBegin = begin + c*chunkSize;
+		size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+		threads.emplace_back(func, c, chunkBegin, chunkEnd);
+	}
+	func(size_t(0), begin, std::min(end, begin + chunkSize));
+
+	for (auto& t : threads)
+		t.join();
+}
+
+//Number of chunks parallelChunks should use for count elements when each
+//chunk should hold at least minChunk elements
+inline size_t chunkCount(size_t count, size_t minChunk = 4096) {
+	return std::max(size_t(1), std::min(size_t(workerThreadCount()), count / std::max(minChunk, size_t(1))));
+}
+
+//Calls func(chunkBegin, chunkEnd) over [begin, end) split across worker threads
+template<typename Func>
+void parallelForRange(size_t begin, size_t end, Func func, size_t minChunk = 4096) {
+	parallelChunks(begin, end, chunkCount(end - begin, minChunk),
+		[&func](size_t, size_t chunkBegin, size_t chunkEnd) { func(chunkBegin, chunkEnd); });
+}
+
+//Calls func(i) for every i in [begin, end) split across worker threads
+template<typename Func>
+void parallelFor(size_t begin, size_t end, Func func, size_t minChunk = 4096) {
+	parallelForRange(begin, end, [&func](size_t chunkBegin, size_t chunkEnd) {
+		for (size_t i = chunkBegin; i < chunkEnd; i++)
+			func(i);
+	}, minChunk);
+}
+
+//Replaces values[i] with the sum of values[0..i) and returns the total. Each
+//chunk sums its range, the chunk totals are scanned serially, then each chunk
+//writes its prefix sums.
+template<typename T>
+T parallelExclusiveScan(T* values, size_t count, size_t minChunk = 65536) {
+	size_t chunkNum = chunkCount(count, minChunk);
+	std::vector<T> chunkTotals(chunkNum + 1, T(0));
+
+	parallelChunks(0, count, chunkNum, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+		T total = T(0);
+		for (size_t i = chunkBegin; i < chunkEnd; i++)
+			total += values[i];
+		chunkTotals[chunk + 1] = total;
+	});
+
+	for (size_t c = 0; c < chunkNum; c++)
+		chunkTotals[c + 1] += chunkTotals[c];
+
+	parallelChunks(0, count, chunkNum, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+		T sum = chunkTotals[chunk];
+		for (size_t i = chunkBegin; i < chunkEnd; i++) {
+			T value = values[i];
+			values[i] = sum;
+			sum += value;
+		}
+	});
+
+	return chunkTotals[chunkNum];
+}
@@ -0,0 +1,297 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+const char FRAME_ZONE[] = "Frame";
+
+const char* const STEAMVR_COLUMNS[FrameCSVLayout::STEAMVR_COLUMN_NUM] = {
+	"FrameIndex", "NumFramePresents", "NumMisPresented", "NumDroppedFrames", "ReprojectionFlags",
+	"SystemTimeInSeconds", "PreSubmitGpuMs", "PostSubmitGpuMs", "TotalRenderGpuMs", "CompositorRenderGpuMs",
+	"CompositorRenderCpuMs", "CompositorIdleCpuMs", "ClientFrameIntervalMs", "PresentCallCpuMs", "WaitForPresentCpuMs",
+	"SubmitFrameMs", "WaitGetPosesCalledMs", "NewPosesReadyMs", "NewFrameReadyMs", "CompositorUpdateStartMs",
+	"CompositorUpdateEndMs", "CompositorRenderStartMs"
+};
+
+//Slot fields are relaxed atomics so a reader racing the writer reads stale
+//values rather than undefined ones
+struct ProfileSlot {
+	atomic<const char*> name;
+	atomic<uint64_t> start;
+	atomic<uint64_t> end;
+	atomic<uint64_t> frame;
+};
+
+//Written only by its own thread. Readers copy the slots below head and
+//discard any the writer may have reused meanwhile.
+struct ProfileRing {
+	string threadName;		//Guarded by the registry's mutex
+	uint32_t threadId;
+	unique_ptr<ProfileSlot[]> slots;
+	atomic<uint64_t> head;		//Zones ever recorded
+	uint64_t lastFrameMark;		//Owning thread only
+
+	ProfileRing(uint32_t threadId) :threadId(threadId), slots(new ProfileSlot[PROFILE_RING_SIZE]), head(0), lastFrameMark(0) {}
+};
+
+//Rings outlive their threads, so zones of finished loaders and savers can still be written out
+struct ProfileRegistry {
+	std::mutex mutex;
+	vector<shared_ptr<ProfileRing>> rings;
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	atomic<uint64_t> frames{ 0 };
+	vector<unique_ptr<string>> names;
+};
+
+ProfileRegistry& registry() {
+	static ProfileRegistry registry;
+	return registry;
+}
+
+#if ENABLE_PROFILER
+ProfileRing& threadRing() {
+	static thread_local shared_ptr<ProfileRing> ring;
+	if (!ring) {
+		ProfileRegistry& reg = registry();
+		lock_guard<std::mutex> lock(reg.mutex);
+		ring = make_shared<ProfileRing>(uint32_t(reg.rings.size()));
+		ring->threadName = "Thread " + to_string(ring->threadId);
+		reg.rings.push_back(ring);
+	}
+	return *ring;
+}
+#endif
+
+//Zone names are literals, only quotes and backslashes need escaping
+void writeJSONString(FILE* f, const char* s) {
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+}
+
+FrameCSVLayout::FrameCSVLayout()
+	:names(STEAMVR_COLUMNS, STEAMVR_COLUMNS + STEAMVR_COLUMN_NUM), filled(STEAMVR_COLUMN_NUM, 0)
+{
+	filled[FRAME_INDEX] = 1;
+	filled[SYSTEM_TIME] = 1;
+	filled[FRAME_INTERVAL] = 1;
+}
+
+size_t FrameCSVLayout::add(const string& column) {
+	size_t index = find(names.begin(), names.end(), column) - names.begin();
+	if (index == names.size()) {
+		names.push_back(column);
+		filled.push_back(0);
+	}
+	filled[index] = 1;
+	return index;
+}
+
+void FrameCSVLayout::writeHeader(FILE* f) const {
+	for (size_t i = 0; i < names.size(); i++)
+		fprintf(f, (i == 0) ? "%s" : ",%s", names[i].c_str());
+	fprintf(f, "\n");
+}
+
+void FrameCSVLayout::writeRow(FILE* f, const vector<double>& values) const {
+	for (size_t i = 0; i < names.size(); i++) {
+		if (i > 0)
+			fputc(',', f);
+		if (!filled[i])
+			continue;
+		//Counts are written as integers, like FrameIndex in the SteamVR logs
+		if (values[i] == floor(values[i]) && fabs(values[i]) < 1e15)
+			fprintf(f, "%.0f", values[i]);
+		else
+			fprintf(f, "%f", values[i]);
+	}
+	fputc('\n', f);
+}
+
+string profileColumnName(const char* name) {
+	string column;
+	bool capitalize = true;
+	for (; *name; name++) {
+		if (*name == ' ' || *name == ',') {
+			capitalize = true;
+			continue;
+		}
+		column += (capitalize) ? char(toupper((unsigned char)*name)) : *name;
+		capitalize = false;
+	}
+	return column + "Ms";
+}
+
+uint64_t profilerNow() {
+	return uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - registry().started).count());
+}
+
+void profileRecord(const char* name, uint64_t start, uint64_t end) {
+#if ENABLE_PROFILER
+	ProfileRing& ring = threadRing();
+	uint64_t head = ring.head.load(memory_order_relaxed);
+	ProfileSlot& slot = ring.slots[head & (PROFILE_RING_SIZE - 1)];
+	slot.name.store(name, memory_order_relaxed);
+	slot.start.store(start, memory_order_relaxed);
+	slot.end.store(end, memory_order_relaxed);
+	slot.frame.store(registry().frames.load(memory_order_relaxed), memory_order_relaxed);
+	ring.head.store(head + 1, memory_order_release);
+#endif
+}
+
+void profileThreadName(const char* name) {
+#if ENABLE_PROFILER
+	ProfileRing& ring = threadRing();
+	lock_guard<std::mutex> lock(registry().mutex);
+	ring.threadName = name;
+#endif
+}
+
+const char* profileName(const string& name) {
+	ProfileRegistry& reg = registry();
+	lock_guard<std::mutex> lock(reg.mutex);
+	for (const auto& interned : reg.names) {
+		if (*interned == name)
+			return interned->c_str();
+	}
+	reg.names.push_back(make_unique<string>(name));
+	return reg.names.back()->c_str();
+}
+
+void profileFrame() {
+#if ENABLE_PROFILER
+	ProfileRing& ring = threadRing();
+	uint64_t now = profilerNow();
+	profileRecord(FRAME_ZONE, ring.lastFrameMark, now);
+	ring.lastFrameMark = now;
+	registry().frames.fetch_add(1, memory_order_relaxed);
+#endif
+}
+
+vector<ProfileThreadEvents> collectProfileEvents(uint64_t since) {
+	vector<ProfileThreadEvents> threads;
+#if ENABLE_PROFILER
+	ProfileRegistry& reg = registry();
+	lock_guard<std::mutex> lock(reg.mutex);
+	for (const auto& ring : reg.rings) {
+		ProfileThreadEvents thread;
+		thread.threadName = ring->threadName;
+		thread.threadId = ring->threadId;
+
+		uint64_t head = ring->head.load(memory_order_acquire);
+		uint64_t first = (head > PROFILE_RING_SIZE) ? head - PROFILE_RING_SIZE : 0;
+		thread.events.reserve(size_t(head - first));
+		for (uint64_t i = first; i < head; i++) {
+			const ProfileSlot& slot = ring->slots[i & (PROFILE_RING_SIZE - 1)];
+			thread.events.push_back({ slot.name.load(memory_order_relaxed), slot.start.load(memory_order_relaxed),
+				slot.end.load(memory_order_relaxed), slot.frame.load(memory_order_relaxed) });
+		}
+
+		//Slots the writer reached while copying may hold newer zones or half
+		//written ones, so they are dropped
+		atomic_thread_fence(memory_order_acquire);
+		uint64_t headAfter = ring->head.load(memory_order_relaxed);
+		uint64_t firstValid = (headAfter >= PROFILE_RING_SIZE) ? headAfter - PROFILE_RING_SIZE + 1 : 0;
+		if (firstValid > first)
+			thread.events.erase(thread.events.begin(), thread.events.begin() + size_t(std::min(firstValid - first, head - first)));
+
+		thread.events.erase(remove_if(thread.events.begin(), thread.events.end(),
+			[&](const ProfileEvent& e) { return e.end < since; }), thread.events.end());
+		threads.push_back(move(thread));
+	}
+#endif
+	return threads;
+}
+
+bool writeProfileTrace(const char* filename, const vector<ProfileThreadEvents>& threads) {
+	FILE* f = fopen(filename, "w");
+	if (f == nullptr) {
+		printf("writeProfileTrace - Could not open %s\n", filename);
+		return false;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (const ProfileThreadEvents& thread : threads) {
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":", (first) ? "" : ",\n", thread.threadId);
+		writeJSONString(f, thread.threadName.c_str());
+		fprintf(f, "}}");
+		first = false;
+
+		//Timestamps are microseconds
+		for (const ProfileEvent& e : thread.events) {
+			fprintf(f, ",\n{\"name\":");
+			writeJSONString(f, e.name);
+			fprintf(f, ",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+				thread.threadId, double(e.start)*1e-3, double(e.end - e.start)*1e-3, (unsigned long long)e.frame);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
+
+bool writeProfileCSV(const char* filename, const vector<ProfileThreadEvents>& threads) {
+	//Frames and the zone names in the order they were first seen
+	vector<const ProfileEvent*> frames;
+	FrameCSVLayout layout;
+	unordered_map<const char*, size_t> columnOf;
+	for (const ProfileThreadEvents& thread : threads) {
+		for (const ProfileEvent& e : thread.events) {
+			if (e.name == FRAME_ZONE) {
+				frames.push_back(&e);
+				continue;
+			}
+			if (!columnOf.count(e.name))
+				columnOf[e.name] = layout.add(profileColumnName(e.name));
+		}
+	}
+	sort(frames.begin(), frames.end(), [](const ProfileEvent* a, const ProfileEvent* b) { return a->frame < b->frame; });
+
+	//Zone totals per frame, zones are counted in the frame they ended in
+	uint64_t firstFrame = (frames.empty()) ? 0 : frames.front()->frame;
+	size_t frameNum = (frames.empty()) ? 0 : size_t(frames.back()->frame - firstFrame + 1);
+	size_t columnNum = layout.size();
+	vector<double> totals(frameNum*columnNum, 0.0);
+	for (const ProfileThreadEvents& thread : threads) {
+		for (const ProfileEvent& e : thread.events) {
+			if (e.name == FRAME_ZONE || e.frame < firstFrame || e.frame - firstFrame >= frameNum)
+				continue;
+			totals[size_t(e.frame - firstFrame)*columnNum + columnOf[e.name]] += double(e.end - e.start)*1e-6;
+		}
+	}
+
+	FILE* f = fopen(filename, "w");
+	if (f == nullptr) {
+		printf("writeProfileCSV - Could not open %s\n", filename);
+		return false;
+	}
+	layout.writeHeader(f);
+	for (const ProfileEvent* frame : frames) {
+		size_t row = size_t(frame->frame - firstFrame);
+		vector<double> values(totals.begin() + row*columnNum, totals.begin() + (row + 1)*columnNum);
+		values[FrameCSVLayout::FRAME_INDEX] = double(frame->frame);
+		values[FrameCSVLayout::SYSTEM_TIME] = double(frame->end)*1e-9;
+		values[FrameCSVLayout::FRAME_INTERVAL] = double(frame->end - frame->start)*1e-6;
+		layout.writeRow(f, values);
+	}
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//Scoped zone profiler for the CPU side of a frame. Every thread records its
+//zones into a ring of its own, written without locks, so a zone costs two
+//clock reads and a store. The rings hold the last PROFILE_RING_SIZE zones of
+//each thread and can be written out at any time as a Chrome trace
+//(chrome://tracing or ui.perfetto.dev) or as a per frame CSV. Setting
+//ENABLE_PROFILER to 0 removes the macros and every recording call.
+#define ENABLE_PROFILER 1
+
+const size_t PROFILE_RING_SIZE = 1 << 16;		//Zones kept per thread, a power of two
+
+struct ProfileEvent {
+	const char* name;		//Static string, only the pointer is kept
+	uint64_t start;			//Nanoseconds since the profiler started
+	uint64_t end;
+	uint64_t frame;			//Frames marked before the zone ended
+};
+
+struct ProfileThreadEvents {
+	std::string threadName;
+	uint32_t threadId;
+	std::vector<ProfileEvent> events;		//In the order they ended
+};
+
+//Nanoseconds since the profiler started
+uint64_t profilerNow();
+
+//Records a zone on the calling thread's ring
+void profileRecord(const char* name, uint64_t start, uint64_t end);
+void profileThreadName(const char* name);
+//Copy of a runtime name that lives as long as the program, for zones named
+//by strings that may be freed before the zones are written out
+const char* profileName(const std::string& name);
+//Records a "Frame" zone from the calling thread's last mark to now
+void profileFrame();
+
+//Copies every thread's zones that ended at or after since. Zones being
+//overwritten while copying are dropped.
+std::vector<ProfileThreadEvents> collectProfileEvents(uint64_t since = 0);
+
+//Chrome trace event JSON of every recorded zone
+bool writeProfileTrace(const char* filename, const std::vector<ProfileThreadEvents>& threads);
+//One row per frame in the FrameCSVLayout, with the total time of each zone
+//name that ended during the frame, e.g. "Submit frame" fills SubmitFrameMs
+bool writeProfileCSV(const char* filename, const std::vector<ProfileThreadEvents>& threads);
+//CSV column of a zone name, "Submit frame" -> "SubmitFrameMs"
+std::string profileColumnName(const char* name);
+
+//Columns of the per frame CSVs. The 22 columns of the SteamVR frame timing
+//logs in Profiling/Logs come first and in their order, so our files load into
+//the same sheets, and columns of our own follow. A column named like a
+//SteamVR one fills it, and SteamVR columns nothing fills are left empty.
+class FrameCSVLayout {
+public:
+	static const size_t STEAMVR_COLUMN_NUM = 22;
+	enum { FRAME_INDEX = 0, SYSTEM_TIME = 5, FRAME_INTERVAL = 12 };		//Filled for every frame
+
+	FrameCSVLayout();
+
+	//Position of column in a row
+	size_t add(const std::string& column);
+	size_t size() const { return names.size(); }
+
+	void writeHeader(FILE* f) const;
+	//values holds size() entries
+	void writeRow(FILE* f, const std::vector<double>& values) const;
+
+private:
+	std::vector<std::string> names;
+	std::vector<char> filled;
+};
+
+class ProfileZone {
+public:
+	ProfileZone(const char* name) :name(name), start(profilerNow()) {}
+	~ProfileZone() { profileRecord(name, start, profilerNow()); }
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	const char* name;
+	uint64_t start;
+};
+
+#if ENABLE_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) profileThreadName(name)
+#define PROFILE_FRAME() profileFrame()
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#endif
@@ -0,0 +1,79 @@
+#include "QuantizedGeometry.h"
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+enum {
+	POSITION = 0, NORMAL, COLOR	//Attribute indices
+};
+
+}
+
+QuantizedGeometry::QuantizedGeometry()
+	:vao(0), vertexBuffer(0), colorBuffer(0), indexBuffer(0), vertexNum(0), indexNum(0), offset(0.f), scale(0.f)
+{
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vertexBuffer);
+	glGenBuffers(1, &colorBuffer);
+	glGenBuffers(1, &indexBuffer);
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glVertexAttribPointer(POSITION, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+		(void*)offsetof(QuantizedVertex, position));
+	glVertexAttribPointer(NORMAL, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+		(void*)offsetof(QuantizedVertex, normal));
+	glEnableVertexAttribArray(POSITION);
+	glEnableVertexAttribArray(NORMAL);
+
+	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+	glVertexAttribIPointer(COLOR, 1, GL_UNSIGNED_BYTE, sizeof(unsigned char), (void*)0);
+	glEnableVertexAttribArray(COLOR);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+QuantizedGeometry::~QuantizedGeometry() {
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &colorBuffer);
+	glDeleteBuffers(1, &indexBuffer);
+	glDeleteVertexArrays(1, &vao);
+}
+
+void QuantizedGeometry::load(const QuantizedMesh& mesh, const unsigned char* colors, const unsigned int* indices, size_t newIndexNum) {
+	vertexNum = mesh.size();
+	indexNum = newIndexNum;
+	offset = mesh.positionOffset();
+	scale = mesh.positionScale();
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexNum*sizeof(QuantizedVertex), mesh.vertices().data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexNum*sizeof(unsigned char), colors, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//The element buffer binding belongs to the vertex array
+	glBindVertexArray(vao);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexNum*sizeof(unsigned int), indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+}
+
+void QuantizedGeometry::loadColors(const unsigned char* colors, size_t colorOffset, size_t count) {
+	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, colorOffset*sizeof(unsigned char), count*sizeof(unsigned char), colors);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void QuantizedGeometry::draw() const {
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, GLsizei(indexNum), GL_UNSIGNED_INT, (void*)0);
+	glBindVertexArray(0);
+}
+
+size_t QuantizedGeometry::memoryUsage() const {
+	return vertexNum*(sizeof(QuantizedVertex) + sizeof(unsigned char)) + indexNum*sizeof(unsigned int);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stddef.h>
+#include <glm/glm.hpp>
+
+#include "QuantizedMesh.h"
+
+//GPU buffers of a QuantizedMesh, with the per vertex color indices in a buffer
+//of their own so label uploads don't touch the vertices. Attribute locations
+//match binMarchingCubeColor.vert, and it is drawn through
+//VRColorShaderBin::drawQuantized, which passes the decode offset and scale.
+class QuantizedGeometry {
+public:
+	QuantizedGeometry();
+	~QuantizedGeometry();
+
+	void load(const QuantizedMesh& mesh, const unsigned char* colors, const unsigned int* indices, size_t indexNum);
+
+	//Replaces the color indices of vertices [offset, offset + count)
+	void loadColors(const unsigned char* colors, size_t offset, size_t count);
+
+	void draw() const;
+
+	glm::vec3 positionOffset() const { return offset; }
+	glm::vec3 positionScale() const { return scale; }
+
+	//Bytes held on the GPU
+	size_t memoryUsage() const;
+
+	QuantizedGeometry(const QuantizedGeometry&) = delete;
+	QuantizedGeometry& operator=(const QuantizedGeometry&) = delete;
+
+private:
+	GLuint vao, vertexBuffer, colorBuffer, indexBuffer;
+	size_t vertexNum, indexNum;
+	glm::vec3 offset, scale;
+};
@@ -0,0 +1,96 @@
+#include "QuantizedMesh.h"
+#include "ParallelFor.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+const float POSITION_STEPS = 65535.f;
+const float NORMAL_STEPS = 32767.f;
+
+float signNotZero(float v) { return (v < 0.f) ? -1.f : 1.f; }
+
+int16_t quantizeSigned(float v) {
+	return int16_t(lroundf(std::min(std::max(v, -1.f), 1.f)*NORMAL_STEPS));
+}
+
+//As the GPU unpacks normalized shorts
+float unquantizeSigned(int16_t q) {
+	return std::max(float(q) / NORMAL_STEPS, -1.f);
+}
+
+}
+
+void encodeOctahedral(vec3 normal, int16_t* encoded) {
+	float l1 = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	if (l1 == 0.f) {
+		encoded[0] = 0;
+		encoded[1] = 0;
+		return;
+	}
+	float u = normal.x / l1;
+	float v = normal.y / l1;
+	//Lower hemisphere folds over the diagonals
+	if (normal.z < 0.f) {
+		float foldedU = (1.f - fabsf(v))*signNotZero(u);
+		v = (1.f - fabsf(u))*signNotZero(v);
+		u = foldedU;
+	}
+	encoded[0] = quantizeSigned(u);
+	encoded[1] = quantizeSigned(v);
+}
+
+vec3 decodeOctahedral(const int16_t* encoded) {
+	vec3 n(unquantizeSigned(encoded[0]), unquantizeSigned(encoded[1]), 0.f);
+	n.z = 1.f - fabsf(n.x) - fabsf(n.y);
+	float t = std::max(-n.z, 0.f);
+	n.x += (n.x >= 0.f) ? -t : t;
+	n.y += (n.y >= 0.f) ? -t : t;
+	return normalize(n);
+}
+
+void QuantizedMesh::encode(const vec3* positions, const vec3* normals, size_t vertexNum) {
+	offset = vec3(0.f);
+	vec3 upper(0.f);
+	for (size_t i = 0; i < vertexNum; i++) {
+		offset = (i == 0) ? positions[i] : min(offset, positions[i]);
+		upper = (i == 0) ? positions[i] : max(upper, positions[i]);
+	}
+	scale = upper - offset;
+
+	quantized.resize(vertexNum);
+	parallelFor(0, vertexNum, [&](size_t i) {
+		QuantizedVertex& q = quantized[i];
+		for (int axis = 0; axis < 3; axis++) {
+			float t = (scale[axis] > 0.f) ? (positions[i][axis] - offset[axis]) / scale[axis] : 0.f;
+			q.position[axis] = uint16_t(lroundf(std::min(std::max(t, 0.f), 1.f)*POSITION_STEPS));
+		}
+		encodeOctahedral(normals ? normals[i] : vec3(0.f, 0.f, 1.f), q.normal);
+		q.padding = 0;
+	});
+}
+
+vec3 QuantizedMesh::position(size_t vertex) const {
+	const QuantizedVertex& q = quantized[vertex];
+	return offset + scale*vec3(float(q.position[0]), float(q.position[1]), float(q.position[2])) / POSITION_STEPS;
+}
+
+vec3 QuantizedMesh::normal(size_t vertex) const {
+	return decodeOctahedral(quantized[vertex].normal);
+}
+
+void QuantizedMesh::decode(vec3* positions, vec3* normals) const {
+	parallelFor(0, quantized.size(), [&](size_t i) {
+		positions[i] = position(i);
+		if (normals)
+			normals[i] = normal(i);
+	});
+}
+
+float QuantizedMesh::maxPositionError() const {
+	return 0.5f*length(scale) / POSITION_STEPS;
+}
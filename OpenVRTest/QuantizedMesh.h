@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+constexpr bool QUANTIZE_VERTICES = false;		//Draw the model from 16 bit positions and octahedral normals
+
+//Vertex with its position as 16 bit fractions of the model's bounding box and
+//its normal as 16 bit octahedral coordinates, 12 bytes against the 24 of
+//float positions and normals
+struct QuantizedVertex {
+	uint16_t position[3];
+	int16_t normal[2];
+	uint16_t padding;		//Keeps vertices 4 byte aligned for the GPU
+};
+
+//Octahedral normal encoding (Cigolle et al. 2014). The unit sphere is folded
+//onto a square, which is stored as two signed 16 bit fractions.
+void encodeOctahedral(glm::vec3 normal, int16_t* encoded);
+glm::vec3 decodeOctahedral(const int16_t* encoded);
+
+//The vertices of a model as QuantizedVertex. Positions decode as
+//positionOffset() + positionScale()*q/65535 on each axis, which the
+//binMarchingCubeColor shaders repeat with the same offset and scale.
+class QuantizedMesh {
+public:
+	//Normals may be null, in which case every normal encodes as +z
+	void encode(const glm::vec3* positions, const glm::vec3* normals, size_t vertexNum);
+
+	glm::vec3 position(size_t vertex) const;
+	glm::vec3 normal(size_t vertex) const;
+
+	//Overwrites positions and normals with their decoded values, so searches
+	//and picking on the CPU see the surface that is drawn. Normals may be null.
+	void decode(glm::vec3* positions, glm::vec3* normals) const;
+
+	//Half a quantization step along the bounding box diagonal, which bounds
+	//how far a position moves up to float rounding
+	float maxPositionError() const;
+
+	const std::vector<QuantizedVertex>& vertices() const { return quantized; }
+	size_t size() const { return quantized.size(); }
+	glm::vec3 positionOffset() const { return offset; }
+	glm::vec3 positionScale() const { return scale; }
+
+	size_t memoryUsage() const { return quantized.capacity()*sizeof(QuantizedVertex); }
+
+private:
+	std::vector<QuantizedVertex> quantized;
+	glm::vec3 offset = glm::vec3(0.f);
+	glm::vec3 scale = glm::vec3(0.f);
+};
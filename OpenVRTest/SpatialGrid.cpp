@@ -0,0 +1,293 @@
+#include "SpatialGrid.h"
+#include "ParallelFor.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <utility>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+const uint32_t NO_CELL = 0xffffffff;
+
+//Spreads the low 21 bits of v out to every third bit
+uint64_t splitBy3(uint32_t v) {
+	uint64_t x = v & 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffffull;
+	x = (x | x << 16) & 0x1f0000ff0000ffull;
+	x = (x | x << 8) & 0x100f00f00f00f00full;
+	x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+	x = (x | x << 2) & 0x1249249249249249ull;
+	return x;
+}
+
+size_t hashCode(uint64_t code, size_t mask) {
+	return size_t((code*0x9e3779b97f4a7c15ull) >> 24) & mask;
+}
+
+}
+
+uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+	return splitBy3(x) | (splitBy3(y) << 1) | (splitBy3(z) << 2);
+}
+
+int64_t SpatialGrid::coordinate(float value, int axis) const {
+	return int64_t(floor(double(value - origin[axis]) / cellSize));
+}
+
+void SpatialGrid::build(const vec3* positions, size_t pointNum) {
+	points.clear();
+	cellCodes.clear();
+	cellOffsets.assign(1, 0);
+	table.clear();
+	tableMask = 0;
+	vertexCells.clear();
+	cellLabels.clear();
+	dirtyCells.clear();
+	cellDirty.clear();
+	origin = vec3(0.f);
+	axisCells[0] = axisCells[1] = axisCells[2] = 0;
+	if (pointNum == 0)
+		return;
+
+	vec3 boundsMin = positions[0];
+	vec3 boundsMax = positions[0];
+	for (size_t i = 0; i < pointNum; i++) {
+		boundsMin = min(boundsMin, positions[i]);
+		boundsMax = max(boundsMax, positions[i]);
+	}
+	origin = boundsMin;
+
+	//Cells must stay wide enough for the coordinates to fit the code
+	float extent = std::max(boundsMax.x - boundsMin.x, std::max(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+	float minCellSize = extent / float(MAX_CELLS_PER_AXIS - 1);
+	if (!(cellSize >= minCellSize) || !(cellSize > 0.f)) {
+		printf("SpatialGrid::build - Cell size %g too small for the model, using %g\n", cellSize, std::max(minCellSize, 1e-6f));
+		cellSize = std::max(minCellSize, 1e-6f);
+	}
+	for (int axis = 0; axis < 3; axis++)
+		axisCells[axis] = uint32_t(std::min(int64_t(MAX_CELLS_PER_AXIS - 1), coordinate(boundsMax[axis], axis))) + 1;
+
+	vector<pair<uint64_t, uint32_t>> order(pointNum);
+	parallelFor(0, pointNum, [&](size_t i) {
+		uint32_t cell[3];
+		for (int axis = 0; axis < 3; axis++)
+			cell[axis] = uint32_t(std::min(int64_t(axisCells[axis] - 1), coordinate(positions[i][axis], axis)));
+		order[i] = make_pair(mortonCode(cell[0], cell[1], cell[2]), uint32_t(i));
+	});
+	sort(order.begin(), order.end());
+
+	points.reserve(pointNum);
+	vertexCells.resize(pointNum);
+	for (size_t i = 0; i < pointNum; i++) {
+		if (i == 0 || order[i].first != order[i - 1].first) {
+			if (i > 0)
+				cellOffsets.push_back(uint32_t(i));
+			cellCodes.push_back(order[i].first);
+		}
+		points.push_back(IndexVec3(order[i].second, positions[order[i].second]));
+		vertexCells[order[i].second] = uint32_t(cellCodes.size() - 1);
+	}
+	cellOffsets.push_back(uint32_t(pointNum));
+
+	//Every label is assumed present until rebuildLabels is called
+	cellLabels.assign(cellCodes.size(), ~uint64_t(0));
+	cellDirty.assign(cellCodes.size(), 0);
+
+	size_t tableSize = 1;
+	while (tableSize < 2 * cellCodes.size())
+		tableSize *= 2;
+	tableMask = tableSize - 1;
+	table.assign(tableSize, NO_CELL);
+	for (size_t cell = 0; cell < cellCodes.size(); cell++) {
+		size_t slot = hashCode(cellCodes[cell], tableMask);
+		while (table[slot] != NO_CELL)
+			slot = (slot + 1) & tableMask;
+		table[slot] = uint32_t(cell);
+	}
+}
+
+uint32_t SpatialGrid::findCell(uint32_t x, uint32_t y, uint32_t z) const {
+	uint64_t code = mortonCode(x, y, z);
+	for (size_t slot = hashCode(code, tableMask);; slot = (slot + 1) & tableMask) {
+		uint32_t cell = table[slot];
+		if (cell == NO_CELL || cellCodes[cell] == code)
+			return cell;
+	}
+}
+
+template<typename Func>
+void SpatialGrid::forEachCell(vec3 p, float radius, Func func) const {
+	if (points.empty())
+		return;
+	uint32_t lower[3], upper[3];
+	for (int axis = 0; axis < 3; axis++) {
+		int64_t low = coordinate(p[axis] - radius, axis);
+		int64_t high = coordinate(p[axis] + radius, axis);
+		if (high < 0 || low >= int64_t(axisCells[axis]))
+			return;
+		lower[axis] = uint32_t(std::max(low, int64_t(0)));
+		upper[axis] = uint32_t(std::min(high, int64_t(axisCells[axis] - 1)));
+	}
+
+	for (uint32_t z = lower[2]; z <= upper[2]; z++) {
+		for (uint32_t y = lower[1]; y <= upper[1]; y++) {
+			for (uint32_t x = lower[0]; x <= upper[0]; x++) {
+				uint32_t cell = findCell(x, y, z);
+				if (cell != NO_CELL)
+					func(cell);
+			}
+		}
+	}
+}
+
+uint64_t SpatialGrid::cellLabelMask(uint32_t cell, const unsigned char* labels) const {
+	uint64_t mask = 0;
+	for (uint32_t i = cellOffsets[cell]; i < cellOffsets[cell + 1]; i++)
+		mask |= labelBit(labels[points[i].index]);
+	return mask;
+}
+
+void SpatialGrid::rebuildLabels(const unsigned char* labels) {
+	parallelFor(0, cellLabels.size(), [&](size_t cell) {
+		cellLabels[cell] = cellLabelMask(uint32_t(cell), labels);
+		cellDirty[cell] = 0;
+	}, 1024);
+	dirtyCells.clear();
+}
+
+bool SpatialGrid::markChanged(size_t vertex) {
+	uint32_t cell = vertexCells[vertex];
+	if (!cellDirty[cell]) {
+		cellDirty[cell] = 1;
+		dirtyCells.push_back(cell);
+	}
+	return true;
+}
+
+void SpatialGrid::refreshChanged(const unsigned char* labels) {
+	for (uint32_t cell : dirtyCells) {
+		cellLabels[cell] = cellLabelMask(cell, labels);
+		cellDirty[cell] = 0;
+	}
+	dirtyCells.clear();
+}
+
+void SpatialGrid::findNeighbours(vec3 p, float radiusSquared, vector<IndexVec3>& neighbours) const {
+	search(p, radiusSquared, neighbours, 0);
+}
+
+void SpatialGrid::findNeighbours(vec3 p, float radiusSquared, vector<IndexVec3>& neighbours, uint64_t skipMask) const {
+	search(p, radiusSquared, neighbours, skipMask);
+}
+
+void SpatialGrid::search(vec3 p, float radiusSquared, vector<IndexVec3>& neighbours, uint64_t skipMask) const {
+	forEachCell(p, sqrt(radiusSquared), [&](uint32_t cell) {
+		if ((cellLabels[cell] & ~skipMask) == 0)
+			return;
+		for (uint32_t i = cellOffsets[cell]; i < cellOffsets[cell + 1]; i++) {
+			vec3 diff = points[i].point - p;
+			if (dot(diff, diff) <= radiusSquared)
+				neighbours.push_back(points[i]);
+		}
+	});
+}
+
+void SpatialGrid::findNeighboursBatch(const vec3* centers, size_t centerNum, float radiusSquared,
+	vector<IndexVec3>& neighbours, uint64_t skipMask) const
+{
+	//Kept per thread, so steady querying doesn't allocate
+	static thread_local vector<uint32_t> cells;
+	cells.clear();
+	for (size_t c = 0; c < centerNum; c++) {
+		forEachCell(centers[c], sqrt(radiusSquared), [&](uint32_t cell) {
+			if ((cellLabels[cell] & ~skipMask) != 0)
+				cells.push_back(cell);
+		});
+	}
+	sort(cells.begin(), cells.end());
+	cells.erase(unique(cells.begin(), cells.end()), cells.end());
+
+	for (uint32_t cell : cells) {
+		for (uint32_t i = cellOffsets[cell]; i < cellOffsets[cell + 1]; i++) {
+			for (size_t c = 0; c < centerNum; c++) {
+				vec3 diff = points[i].point - centers[c];
+				if (dot(diff, diff) <= radiusSquared) {
+					neighbours.push_back(points[i]);
+					break;
+				}
+			}
+		}
+	}
+}
+
+uint64_t SpatialGrid::labelsInSphere(vec3 p, float radius, const unsigned char* labels) const {
+	uint64_t mask = 0;
+	forEachCell(p, radius, [&](uint32_t cell) {
+		for (uint32_t i = cellOffsets[cell]; i < cellOffsets[cell + 1]; i++) {
+			vec3 diff = points[i].point - p;
+			if (dot(diff, diff) <= radius*radius)
+				mask |= labelBit(labels[points[i].index]);
+		}
+	});
+	return mask;
+}
+
+//Visits shells of cells around p's cell in order of Chebyshev distance.
+//Cells in shell k are at least (k - 1)*cellSize from p, so the search stops
+//once the best distance is within that.
+size_t SpatialGrid::findNearest(vec3 p, float maxDistanceSquared) const {
+	if (points.empty())
+		return size_t(-1);
+
+	int64_t center[3];
+	int64_t maxRing = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		center[axis] = std::min(std::max(coordinate(p[axis], axis), int64_t(0)), int64_t(axisCells[axis] - 1));
+		maxRing = std::max(maxRing, std::max(center[axis], int64_t(axisCells[axis]) - 1 - center[axis]));
+	}
+
+	size_t best = size_t(-1);
+	float bestDistanceSquared = maxDistanceSquared;
+	auto visit = [&](int64_t x, int64_t y, int64_t z) {
+		if (x < 0 || y < 0 || z < 0 || x >= axisCells[0] || y >= axisCells[1] || z >= axisCells[2])
+			return;
+		uint32_t cell = findCell(uint32_t(x), uint32_t(y), uint32_t(z));
+		if (cell == NO_CELL)
+			return;
+		for (uint32_t i = cellOffsets[cell]; i < cellOffsets[cell + 1]; i++) {
+			vec3 diff = points[i].point - p;
+			float d = dot(diff, diff);
+			if (d <= bestDistanceSquared) {
+				bestDistanceSquared = d;
+				best = points[i].index;
+			}
+		}
+	};
+
+	for (int64_t ring = 0; ring <= maxRing; ring++) {
+		float ringDistance = float(std::max(ring - 1, int64_t(0)))*cellSize;
+		if (ringDistance*ringDistance > bestDistanceSquared)
+			break;
+		for (int64_t dz = -ring; dz <= ring; dz++) {
+			for (int64_t dy = -ring; dy <= ring; dy++) {
+				bool onShell = (dz == -ring || dz == ring || dy == -ring || dy == ring);
+				int64_t step = (onShell || ring == 0) ? 1 : 2 * ring;
+				for (int64_t dx = -ring; dx <= ring; dx += step)
+					visit(center[0] + dx, center[1] + dy, center[2] + dz);
+			}
+		}
+	}
+
+	return best;
+}
+
+size_t SpatialGrid::memoryUsage() const {
+	return points.capacity()*sizeof(IndexVec3) + cellCodes.capacity()*sizeof(uint64_t)
+		+ cellOffsets.capacity()*sizeof(uint32_t) + table.capacity()*sizeof(uint32_t)
+		+ vertexCells.capacity()*sizeof(uint32_t) + cellLabels.capacity()*sizeof(uint64_t)
+		+ dirtyCells.capacity()*sizeof(uint32_t) + cellDirty.capacity();
+}
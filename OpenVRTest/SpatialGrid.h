@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "VertexIndex.h"
+
+//Uniform grid over the vertices for sphere queries of bounded size. Cells are
+//cellSize wide and ordered by the Morton code of their coordinates, and each
+//cell's vertices are stored contiguously in that order, so neighbouring cells
+//are mostly close in memory. Occupied cells are found through an open
+//addressing hash table keyed by code. A query touches about
+//(2*radius/cellSize + 1)^3 cells. Each cell also keeps a bitmask of the labels
+//of its vertices, and searches with a skipMask pass over cells that only hold
+//skippable labels.
+class SpatialGrid : public VertexIndex {
+public:
+	static const uint32_t MAX_CELLS_PER_AXIS = 1 << 21;		//Coordinates fit 21 bits of the Morton code
+
+	SpatialGrid(float cellSize) :cellSize(cellSize) {}
+
+	const char* name() const override { return "grid"; }
+
+	void build(const glm::vec3* positions, size_t pointNum) override;
+
+	void findNeighbours(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours) const override;
+	void findNeighbours(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours, uint64_t skipMask) const override;
+
+	//Cells reached by several spheres are scanned once
+	void findNeighboursBatch(const glm::vec3* centers, size_t centerNum, float radiusSquared,
+		std::vector<IndexVec3>& neighbours, uint64_t skipMask = 0) const override;
+
+	size_t findNearest(glm::vec3 p, float maxDistanceSquared = std::numeric_limits<float>::max()) const override;
+
+	uint64_t labelsInSphere(glm::vec3 p, float radius, const unsigned char* labels) const override;
+
+	//Recomputes every cell's label mask from labels
+	void rebuildLabels(const unsigned char* labels) override;
+
+	size_t memoryUsage() const override;
+
+	float getCellSize() const { return cellSize; }
+	size_t cellCount() const { return cellCodes.size(); }
+
+protected:
+	bool tracksLabels() const override { return !cellLabels.empty(); }
+	bool markChanged(size_t vertex) override;
+	void refreshChanged(const unsigned char* labels) override;
+
+private:
+	float cellSize;
+	glm::vec3 origin;
+	uint32_t axisCells[3];
+
+	std::vector<IndexVec3> points;		//Sorted by cell
+	std::vector<uint64_t> cellCodes;	//Morton code of each occupied cell, ascending
+	std::vector<uint32_t> cellOffsets;	//Points of cell i are points[cellOffsets[i]] up to points[cellOffsets[i + 1]]
+	std::vector<uint32_t> table;		//Hash slot to cell index
+	std::vector<uint32_t> vertexCells;	//Cell of each vertex
+	std::vector<uint64_t> cellLabels;	//Labels present in each cell
+	std::vector<uint32_t> dirtyCells;	//Cells whose labels changed since the last refresh
+	std::vector<unsigned char> cellDirty;
+	size_t tableMask;
+
+	int64_t coordinate(float value, int axis) const;
+	uint32_t findCell(uint32_t x, uint32_t y, uint32_t z) const;
+	uint64_t cellLabelMask(uint32_t cell, const unsigned char* labels) const;
+	void search(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours, uint64_t skipMask) const;
+
+	//Calls func(cellIndex) for every occupied cell overlapping the box around p
+	template<typename Func>
+	void forEachCell(glm::vec3 p, float radius, Func func) const;
+};
+
+//Interleaves the low 21 bits of x, y and z
+uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z);
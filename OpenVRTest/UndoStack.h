@@ -5,6 +5,9 @@
 #include <utility>
 #include <stdexcept>
 #include <algorithm>
+#include <memory>
+#include <functional>
+#include <stdio.h>
 #include <Bitmask.h>
 
 template<typename T>
@@ -52,6 +55,8 @@ public:
 	void clear() {
 		mSize = 0;
 	}
+	//Every slot, including popped ones that still hold their contents
+	const std::vector<T>& storage() const { return mData; }
 };
 
 template<typename T>
@@ -107,7 +112,7 @@ public:
 		try {
 			//Store new and old values until propagated with propagateLastState()
 			previousStates.last()[element] = WriteInfo<T>(data[element], value);
-		} catch (out_of_range) {
+		} catch (std::out_of_range) {
 			printf("UndoStack::modify -- Out of range exception\n");
 		}
 	}
@@ -118,7 +123,7 @@ public:
 			if(!mask.test(data[element]))
 				previousStates.last()[element] = WriteInfo<T>(data[element], value);
 		}
-		catch (out_of_range) {
+		catch (std::out_of_range) {
 			printf("UndoStack::modify -- Out of range exception\n");
 		}
 	}
@@ -131,7 +136,7 @@ public:
 		redoStates.clear();
 		propagateLastState();
 		if (previousStates.size() == 0 || previousStates.last().size() > 0) {
-			previousStates.push(map<size_t, WriteInfo<T>>());
+			previousStates.push(std::map<size_t, WriteInfo<T>>());
 			lastStateUnfinished = true;
 		}
 	}
@@ -169,10 +174,38 @@ public:
 };
 
 
+//Edit recorded as a whole rather than as individual element writes, for
+//changes too large to keep in a WriteInfo map
+template<typename T>
+class UndoOperation {
+public:
+	virtual ~UndoOperation() {}
+	virtual void apply(T* data) const = 0;		//Make (or redo) the change
+	virtual void revert(T* data) const = 0;		//Undo the change
+	virtual size_t memoryUsage() const = 0;
+
+	//Calls func(element, oldValue, newValue) for every element apply changes
+	virtual void forEachChange(const std::function<void(size_t, T, T)>& func) const = 0;
+};
+
+template<typename T>
+struct UndoState {
+	std::map<size_t, WriteInfo<T>> writes;
+	std::shared_ptr<const UndoOperation<T>> operation;
+
+	bool empty() const { return writes.empty() && !operation; }
+
+	//Map nodes are counted with their value and three links and a color
+	size_t memoryUsage() const {
+		const size_t NODE_BYTES = sizeof(std::pair<const size_t, WriteInfo<T>>) + 4 * sizeof(void*);
+		return writes.size()*NODE_BYTES + ((operation) ? operation->memoryUsage() : 0);
+	}
+};
+
 template<typename T>
 class UndoStackRef {
-	RingStack<std::map<size_t, WriteInfo<T>>> previousStates;		//Shows changes required to return to previous state
-	std::vector<std::map<size_t, WriteInfo<T>>> redoStates;
+	RingStack<UndoState<T>> previousStates;		//Shows changes required to return to previous state
+	std::vector<UndoState<T>> redoStates;
 public:
 	UndoStackRef(size_t maxUndo)
 		:previousStates(maxUndo){}
@@ -181,31 +214,62 @@ public:
 		try {
 			//Store new and old values until propagated with propagateLastState()
 			if (!mask.test(data[element])) {
-				auto pos = previousStates.last().find(element);
-				if (pos == previousStates.last().end())
-					previousStates.last()[element] = WriteInfo<T>(data[element], value);
+				auto& writes = previousStates.last().writes;
+				auto pos = writes.find(element);
+				if (pos == writes.end())
+					writes[element] = WriteInfo<T>(data[element], value);
 				else
 					pos->second.newValue = value;
 			}
 		}
-		catch (out_of_range) {
+		catch (std::out_of_range) {
 			printf("UndoStack::modify -- Out of range exception\n");
 		}
 	}
 
+	//Moves writes into the last state, as if each had been made with modify.
+	//Elements the state already holds keep their old value and take the new one.
+	void mergeWrites(std::map<size_t, WriteInfo<T>>& writes) {
+		auto& last = previousStates.last().writes;
+		last.merge(writes);
+		for (const auto& it : writes)
+			last.find(it.first)->second.newValue = it.second.newValue;
+		writes.clear();
+	}
+
 	void startNewState() {
 		redoStates.clear();
-		if (previousStates.size() == 0 || previousStates.last().size() > 0) {
-			previousStates.push(map<size_t, WriteInfo<T>>());
+		if (previousStates.size() == 0 || !previousStates.last().empty()) {
+			previousStates.push(UndoState<T>());
 		}
 	}
 
+	//Records an operation that has already been applied as its own undo step.
+	//Writes made afterwards go to a new state.
+	void pushOperation(std::shared_ptr<const UndoOperation<T>> operation) {
+		redoStates.clear();
+		if (previousStates.size() == 0 || !previousStates.last().empty())
+			previousStates.push(UndoState<T>());
+		previousStates.last().operation = operation;
+		previousStates.push(UndoState<T>());
+	}
+
 	const std::map<size_t, WriteInfo<T>>& getLastState() const {
-		return previousStates.last();
+		return previousStates.last().writes;
+	}
+
+	//Bytes held by every undo and redo state
+	size_t memoryUsage() const {
+		size_t bytes = 0;
+		for (const UndoState<T>& state : previousStates.storage())
+			bytes += sizeof(UndoState<T>) + state.memoryUsage();
+		for (const UndoState<T>& state : redoStates)
+			bytes += sizeof(UndoState<T>) + state.memoryUsage();
+		return bytes;
 	}
 
 	int lowestIndex() {
-		if (previousStates.size())
+		if (previousStates.size() > 0 && getLastState().size() > 0)
 			return getLastState().begin()->first;
 		else
 			return -1;
@@ -217,27 +281,36 @@ public:
 			return -1;
 	}
 
-	void undo(std::map<size_t, T>* changes) {
-		if (previousStates.size() > 0 && previousStates.last().size() == 0) {
+	//Individual writes are returned in changes, any map from element to value.
+	//If the step was recorded with pushOperation the operation is returned
+	//instead, and the caller reverts it.
+	template<typename Map>
+	void undo(Map* changes, std::shared_ptr<const UndoOperation<T>>* operation = nullptr) {
+		if (previousStates.size() > 0 && previousStates.last().empty()) {
 			previousStates.pop();
 		}
-		if (previousStates.size() > 0 && previousStates.last().size() > 0) {
+		if (previousStates.size() > 0 && !previousStates.last().empty()) {
 			//Build redo information and apply undo
 			redoStates.push_back(previousStates.last());
-			for (const auto &it : previousStates.last()) {
+			for (const auto &it : previousStates.last().writes) {
 				(*changes)[it.first] = it.second.oldValue;
 			}
+			if (operation)
+				*operation = previousStates.last().operation;
 			previousStates.pop();
 		}
 	}
-	void redo(std::map<size_t, T>* changes) {
+	//The returned operation, if any, should be applied by the caller
+	template<typename Map>
+	void redo(Map* changes, std::shared_ptr<const UndoOperation<T>>* operation = nullptr) {
 		if (redoStates.size() > 0) {
 			previousStates.push(redoStates.back());
-			for (const auto &it : redoStates.back()) {
+			for (const auto &it : redoStates.back().writes) {
 				(*changes)[it.first] = it.second.newValue;
 			}
+			if (operation)
+				*operation = redoStates.back().operation;
 			redoStates.pop_back();
 		}
 	}
 };
-
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ParallelFor.h"
+
+//Lock-free union-find over the indices [0, count). Roots always link to the
+//smaller root, so parent[v] <= v and every set ends up rooted at its lowest
+//index whatever order the unions run in.
+class ConcurrentUnionFind {
+public:
+	ConcurrentUnionFind(size_t count) :count(count), parent(new std::atomic<uint32_t>[count]) {
+		parallelFor(0, count, [&](size_t v) { parent[v].store(uint32_t(v), std::memory_order_relaxed); });
+	}
+
+	size_t size() const { return count; }
+
+	uint32_t find(uint32_t v) {
+		while (true) {
+			uint32_t p = parent[v].load(std::memory_order_relaxed);
+			if (p == v)
+				return v;
+			uint32_t grandparent = parent[p].load(std::memory_order_relaxed);
+			if (p != grandparent)
+				parent[v].compare_exchange_weak(p, grandparent, std::memory_order_relaxed);		//Path halving
+			v = grandparent;
+		}
+	}
+
+	void unite(uint32_t a, uint32_t b) {
+		while (true) {
+			a = find(a);
+			b = find(b);
+			if (a == b)
+				return;
+			if (a < b)
+				std::swap(a, b);
+			uint32_t expected = a;
+			if (parent[a].compare_exchange_strong(expected, b))
+				return;
+		}
+	}
+
+private:
+	size_t count;
+	std::unique_ptr<std::atomic<uint32_t>[]> parent;
+};
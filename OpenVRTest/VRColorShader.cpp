@@ -28,6 +28,8 @@ struct uniform {
 	FOG_DISTANCE_LOCATION,
 	FOG_COLOR_LOCATION,
 	FOG_SCALE_LOCATION,
+	POSITION_OFFSET_LOCATION,
+	POSITION_SCALE_LOCATION,
 	COUNT
 	};
 };
@@ -39,12 +41,13 @@ vector<pair<GLenum, string>> VRColorShaderBin::shaders() {
 	};
 }
 
-VRColorShaderBin::VRColorShaderBin(int maxColorNum)
+VRColorShaderBin::VRColorShaderBin(int maxColorNum, bool quantizedVertices)
 	:ShaderT<ShadedMat, ColorSetMat>(shaders(), 
-		{{GL_VERTEX_SHADER, std::string("#define MAX_COLOR_NUM " + to_string(maxColorNum) + "\n") } }, 
+		{{GL_VERTEX_SHADER, std::string("#define MAX_COLOR_NUM " + to_string(maxColorNum) + "\n")
+			+ (quantizedVertices ? "#define QUANTIZED_VERTICES\n" : "") } }, 
 		{ "ka", "ks", "kd", "alpha",
 		"colors", "visibility", "view_projection_matrix", "model_matrix", "viewPosition", "lightPos",
-		"fogDist", "fogColor", "fogScale" }){}
+		"fogDist", "fogColor", "fogScale", "positionOffset", "positionScale" }){}
 
 void VRColorShaderBin::draw(const Camera &cam_left, const Camera &cam_right, glm::vec3 lightPos,
 	float fogScale, float fogDistance, glm::vec3 fogColor, Drawable &obj) 
@@ -103,6 +106,35 @@ void VRColorShaderBin::drawNew(const Camera &cam_left, const Camera &cam_right,
 	glUseProgram(0);
 }
 
+void VRColorShaderBin::drawQuantized(const Camera &cam_left, const Camera &cam_right, glm::vec3 lightPos,
+	float fogScale, float fogDistance, glm::vec3 fogColor, Drawable &obj, const QuantizedGeometry &geometry)
+{
+	glUseProgram(programID);
+
+	mat4 vp_matrix[2] = {
+			cam_left.getProjectionMatrix()*cam_left.getCameraMatrix(),
+			cam_right.getProjectionMatrix()*cam_right.getCameraMatrix() };
+
+	mat4 m_matrix = obj.getTransform();
+	vec3 camera_pos[2] = { cam_left.getPosition(), cam_right.getPosition() };
+	vec3 positionOffset = geometry.positionOffset();
+	vec3 positionScale = geometry.positionScale();
+
+	loadMaterialUniforms(obj);
+	glUniformMatrix4fv(uniformLocations[uniform::VP_MATRIX_LOCATION], 2, false, &vp_matrix[0][0][0]);
+	glUniformMatrix4fv(uniformLocations[uniform::M_MATRIX_LOCATION], 1, false, &m_matrix[0][0]);
+	glUniform3fv(uniformLocations[uniform::VIEW_LOCATION], 2, &camera_pos[0][0]);
+	glUniform3f(uniformLocations[uniform::LIGHT_POS_LOCATION], lightPos.x, lightPos.y, lightPos.z);
+	glUniform1f(uniformLocations[uniform::FOG_SCALE_LOCATION], fogScale);
+	glUniform1f(uniformLocations[uniform::FOG_DISTANCE_LOCATION], fogDistance);
+	glUniform3f(uniformLocations[uniform::FOG_COLOR_LOCATION], fogColor.x, fogColor.y, fogColor.z);
+	glUniform3f(uniformLocations[uniform::POSITION_OFFSET_LOCATION], positionOffset.x, positionOffset.y, positionOffset.z);
+	glUniform3f(uniformLocations[uniform::POSITION_SCALE_LOCATION], positionScale.x, positionScale.y, positionScale.z);
+
+	geometry.draw();
+	glUseProgram(0);
+}
+
 ///////////////////
 // VRColorShader
 ///////////////////
@@ -11,6 +11,7 @@
 #include "TemplatedShader.h"
 #include "ColorSetMat.h"
 #include "ShadedMat.h"
+#include "QuantizedGeometry.h"
 #include <vector>
 
 namespace renderlib {
@@ -19,12 +20,17 @@ class VRColorShaderBin : public ShaderT<ShadedMat, ColorSetMat> {
 	static vector<pair<GLenum, string>> shaders();
 	 
 public:
-	VRColorShaderBin(int maxColorNum);
+	//With quantizedVertices the program reads QuantizedGeometry's vertices
+	//instead of float positions and normals
+	VRColorShaderBin(int maxColorNum, bool quantizedVertices = false);
 	VRColorShaderBin(int maxColorNum, std::vector<pair<GLenum, string>> newShaders);
 	void draw(const Camera &leftCam, const Camera &rightCam, glm::vec3 lightPos,
 		float fogScale, float fogDistance, glm::vec3 fogColor, Drawable &obj);
 	void drawNew(const Camera &leftCam, const Camera &rightCam, glm::vec3 lightPos,
 		float fogScale, float fogDistance, glm::vec3 fogColor, Drawable &obj);
+	//Draws geometry with the materials and transform of obj
+	void drawQuantized(const Camera &leftCam, const Camera &rightCam, glm::vec3 lightPos,
+		float fogScale, float fogDistance, glm::vec3 fogColor, Drawable &obj, const QuantizedGeometry &geometry);
 };
 
 
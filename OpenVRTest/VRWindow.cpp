@@ -1,6 +1,7 @@
 #include "VRWindow.h"
 
 #include <iostream>
+#include <string.h>
 
 using namespace glm;
 using namespace std;
@@ -33,6 +34,18 @@ using namespace std;
 #include "kd_tree.h"
 #include "VolumeIO.h"
 #include "UndoStack.h"
+#include "MeshBVH.h"
+#include "MeshAdjacency.h"
+#include "GeodesicBrush.h"
+#include "LabelOps.h"
+#include "LabelMorphology.h"
+#include "VertexIndex.h"
+#include "VertexKDTree.h"
+#include "ParallelBrush.h"
+#include "LabelStatistics.h"
+#include "LabelExport.h"
+#include "MeshWeld.h"
+#include "QuantizedMesh.h"
 #include "ColorWheel.h"
 #include "VRColorShader.h"
 #include "BlinnPhongShaderVR.h"
@@ -43,6 +56,14 @@ using namespace std;
 #include "VRDeviceManager.h"
 
 #include "MultiThreadedResource.h"
+#include "WorkQueue.h"
+#include "FrameArena.h"
+#include "AllocationCounter.h"
+#include "LabelStore.h"
+#include "FramePipeline.h"
+#include "Profiler.h"
+#include "FlightRecorder.h"
+#include "MemoryTracker.h"
 
 #include "ControllerMovement.h"
 
@@ -52,6 +73,7 @@ using namespace std;
 #include <stb/stb_image_write.h>
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 const float PI = 3.14159265358979323846;
 
@@ -504,31 +526,6 @@ void WindowManager::mainLoopNoAO() {
 	*/
 }
 
-////////////////////////////////////////////
-// Support structs and functions for KDTree
-////////////////////////////////////////////
-struct IndexVec3 {
-	size_t index;
-	vec3 point;
-	IndexVec3(size_t index, vec3 point) :index(index), point(point) {}
-	float operator[](size_t index) const { return point[index]; }
-	float &operator[](size_t index) { return point[index]; }
-	IndexVec3 operator-(IndexVec3 p) const {
-		p.point = point - p.point;
-		p.index = -1;
-		return p;
-	}
-};
-
-float distanceSquared(IndexVec3 const &a, IndexVec3 const &b) {
-	vec3 diff = a.point - b.point;
-	return dot(diff, diff);
-}
-
-namespace spatial {
-template<> constexpr uint16_t dimensions<IndexVec3>() { return 3; }
-}
-
 //Kalaxy - https://stackoverflow.com/questions/485525/round-for-float-in-c/4660122#4660122
 int round_int(float val) {
 	return (val > 0.f) ? (val + 0.5f) : (val - 0.5f);
@@ -751,16 +748,8 @@ vec3 closestPointOnTriangle(vec3 a, vec3 b, vec3 c, vec3 point) {
 }
 
 bool hitTriangle(vec3 a, vec3 b, vec3 c, vec3 ray, vec3 origin) {
-	mat3 matrix = mat3(a - b, a - c, ray);
-	vec3 result = inverse(matrix)*(a - origin);
-
-	if (result.x < 0
-		|| result.y < 0
-		|| result.x + result.y > 1
-		|| result.z < 0.f)
-		return false;
-	else 
-		return true;
+	float t, u, v;
+	return intersectTriangle(origin, ray, a, b, c, &t, &u, &v);
 }
 
 bool isWithinConvexHull(vec3 point, vec3* hullPoints, unsigned int pointNum, unsigned int* hullFaces, unsigned int faceNum) {
@@ -1100,12 +1089,8 @@ void WindowManager::paintingLoop(const char* loadedFile, const char* savedFile,
 	}
 
 	//Setup KDTree
-	vector<IndexVec3> vertIndexPair;
-	for (int i = 0; i < minfo.vertices.size(); i++) {
-		vertIndexPair.push_back(IndexVec3(i, minfo.vertices[i]));
-	}
-	using namespace spatial;
-	build_kdTree_inplace<dimensions<IndexVec3>()>(vertIndexPair.begin(), vertIndexPair.end());
+	VertexKDTree kdTree;
+	kdTree.build(minfo.vertices.data(), minfo.vertices.size());
 
 	//Load convex hull
 	string convexHullName = swapExtension(objName, ".hull");
@@ -1281,11 +1266,7 @@ void WindowManager::paintingLoop(const char* loadedFile, const char* savedFile,
 						paintingButtonPressed[i] = true;
 						undoStack.startNewState();
 					}
-					kdTree_findNeighbours<dimensions<IndexVec3>()>(
-						vertIndexPair.begin(), vertIndexPair.end(),
-						IndexVec3(-1, pos),
-						searchRadius*searchRadius,
-						neighbours);
+					kdTree.findNeighbours(pos, searchRadius*searchRadius, neighbours);
 				}
 				else {
 					paintingButtonPressed[i] = false;
@@ -1552,8 +1533,8 @@ std::string stringFormat(const char* string, Args... args) {
 	return std::string(buffer);
 }
 
-void pushDebugGroup(std::string name) {
-	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, name.size(), name.c_str());
+void pushDebugGroup(const char* name) {
+	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, GLsizei(strlen(name)), name);
 }
 
 void WindowManager::paintingLoopIndexed(const char* loadedFile, const char* savedFile, int sampleNumber) {
@@ -1796,12 +1777,8 @@ void WindowManager::paintingLoopIndexed(const char* loadedFile, const char* save
 	}
 
 	//Setup KDTree
-	vector<IndexVec3> vertIndexPair;
-	for (int i = 0; i < minfo.vertices.size(); i++) {
-		vertIndexPair.push_back(IndexVec3(i, minfo.vertices[i]));
-	}
-	using namespace spatial;
-	build_kdTree_inplace<dimensions<IndexVec3>()>(vertIndexPair.begin(), vertIndexPair.end());
+	VertexKDTree kdTree;
+	kdTree.build(minfo.vertices.data(), minfo.vertices.size());
 
 	//Load convex hull
 	string convexHullName = swapExtension(objName, ".hull");
@@ -1982,11 +1959,7 @@ void WindowManager::paintingLoopIndexed(const char* loadedFile, const char* save
 						paintingButtonPressed[i] = true;
 						undoStack.startNewState();
 					}
-					kdTree_findNeighbours<dimensions<IndexVec3>()>(
-						vertIndexPair.begin(), vertIndexPair.end(),
-						IndexVec3(-1, pos),
-						searchRadius*searchRadius,
-						neighbours);
+					kdTree.findNeighbours(pos, searchRadius*searchRadius, neighbours);
 				}
 				else {
 					paintingButtonPressed[i] = false;
@@ -2235,23 +2208,35 @@ glfwPollEvents();
 struct StateInfo {
 	enum {
 		UNDO = 0,
-		REDO
+		REDO,
+		FILL,
+		REPLACE,
+		SWAP,
+		CLEAR,
+		QUERY_LABELS,
+		DILATE,
+		ERODE,
+		SMOOTH
 	};
 	std::vector<glm::vec3> controllerPositions;			//Only lists controllers with draw button pressed
-	int action;		//Undo, redo or release
+	int action;		//Undo, redo, fill, label operation or release
+	glm::vec3 toolPosition;		//Model space position used by fill and label operations
+	int labelScope;				//LabelScope of label operations
+	int morphologyRings;		//Rings grown or shrunk, or smoothing passes
 	size_t timestamp;
 
 	unsigned char drawColor;
 	float scaledDrawRadius;
 	bool shouldClose;
+	bool geodesicBrush;		//Paint along the surface instead of everything inside the sphere
 	Bitmask visibility;
 
-	StateInfo(size_t timestamp = 0) :action(-1), timestamp(timestamp), shouldClose(false) {}
+	StateInfo(size_t timestamp = 0) :action(-1), labelScope(SCOPE_ALL), morphologyRings(1), timestamp(timestamp), shouldClose(false), geodesicBrush(false) {}
 	StateInfo(std::vector<glm::vec3> controllerPositions, unsigned char drawColor, float scaledDrawRadius, size_t timestamp)
-		:controllerPositions(controllerPositions), action(-1), timestamp(timestamp), drawColor(drawColor),
-		scaledDrawRadius(scaledDrawRadius), shouldClose(false) {}
-	StateInfo(int action, size_t actionTimestamp, size_t timestamp) :action(action), timestamp(timestamp), shouldClose(false) {}
-	StateInfo(bool shouldClose) :shouldClose(shouldClose) {}
+		:controllerPositions(controllerPositions), action(-1), labelScope(SCOPE_ALL), morphologyRings(1), timestamp(timestamp), drawColor(drawColor),
+		scaledDrawRadius(scaledDrawRadius), shouldClose(false), geodesicBrush(false) {}
+	StateInfo(int action, size_t actionTimestamp, size_t timestamp) :action(action), labelScope(SCOPE_ALL), morphologyRings(1), timestamp(timestamp), shouldClose(false), geodesicBrush(false) {}
+	StateInfo(bool shouldClose) :action(-1), labelScope(SCOPE_ALL), morphologyRings(1), timestamp(0), shouldClose(shouldClose), geodesicBrush(false) {}
 };
 
 struct ChangedRange {
@@ -2261,25 +2246,114 @@ struct ChangedRange {
 	ChangedRange(int begin, int end, int timestamp) :begin(begin), end(end), timestamp(timestamp) {}
 };
 
-void paintingThreadFunc(std::vector<vec3>& positions, Resource<StateInfo, 3>::ReadOnly stateInfo,
-	Resource<std::vector<unsigned char>, 3>& colors, Resource<ChangedRange, 3>& changedRange)
+//States that paint with the same brush and carry no action
+bool canBatch(const StateInfo& a, const StateInfo& b) {
+	if (a.action != -1 || b.action != -1 || a.shouldClose || b.shouldClose
+		|| a.controllerPositions.empty() || b.controllerPositions.empty()
+		|| a.drawColor != b.drawColor || a.scaledDrawRadius != b.scaledDrawRadius || a.geodesicBrush != b.geodesicBrush)
+		return false;
+	for (int label = 0; label < 256; label++) {
+		if (a.visibility.test(label) != b.visibility.test(label))
+			return false;
+	}
+	return true;
+}
+
+//Run of queued states painted as one, with the brush of its first state
+struct PaintingBatch {
+	const StateInfo* state;
+	const glm::vec3* controllerPositions;
+	size_t positionNum;
+};
+
+//Splits the queued states into runs that canBatch, so the samples of every
+//frame since the last tick are answered by one query. The positions of each
+//run are gathered contiguously in positions, which the batches point into.
+void batchPaintingStates(const std::vector<StateInfo>& states, ArenaVector<glm::vec3>* positions, ArenaVector<PaintingBatch>* batches) {
+	size_t positionNum = 0;
+	for (const StateInfo& state : states)
+		positionNum += state.controllerPositions.size();
+	positions->clear();
+	positions->reserve(positionNum);
+	batches->clear();
+
+	for (const StateInfo& state : states) {
+		if (batches->empty() || !canBatch(*batches->back().state, state))
+			batches->push_back({ &state, positions->data() + positions->size(), 0 });
+		positions->insert(positions->end(), state.controllerPositions.begin(), state.controllerPositions.end());
+		batches->back().positionNum += state.controllerPositions.size();
+	}
+}
+
+//How much the painting thread coalesces, printed every interval
+struct PaintingTickMetrics {
+	size_t ticks = 0;
+	size_t states = 0;		//Drained from the queue
+	size_t batches = 0;		//Left after merging
+	size_t maxDepth = 0;
+	double busySeconds = 0.0;
+	double maxTickSeconds = 0.0;
+	size_t allocations = 0;		//Heap allocations, counted when COUNT_HEAP_ALLOCATIONS is on
+	size_t maxTickAllocations = 0;
+
+	void record(size_t drained, size_t merged, double seconds, size_t tickAllocations) {
+		ticks++;
+		states += drained;
+		batches += merged;
+		maxDepth = std::max(maxDepth, drained);
+		busySeconds += seconds;
+		maxTickSeconds = std::max(maxTickSeconds, seconds);
+		allocations += tickAllocations;
+		maxTickAllocations = std::max(maxTickAllocations, tickAllocations);
+	}
+
+	void print(double intervalSeconds) const {
+		if (ticks == 0)
+			return;
+		printf("paintingThreadFunc - %zu ticks, %.2f states and %.2f batches per tick (max %zu), %.3f ms per tick (max %.3f), %.1f%% busy\n",
+			ticks, double(states) / double(ticks), double(batches) / double(ticks), maxDepth,
+			busySeconds*1000.0 / double(ticks), maxTickSeconds*1000.0, 100.0*busySeconds / intervalSeconds);
+		if (COUNT_HEAP_ALLOCATIONS)
+			printf("paintingThreadFunc - %.2f heap allocations per tick (max %zu)\n",
+				double(allocations) / double(ticks), maxTickAllocations);
+	}
+};
+
+void paintingThreadFunc(std::vector<vec3>& positions, const MeshAdjacency& adjacency, VertexIndex& vertexIndex, LabelStatistics& labelStatistics,
+	WorkQueue<StateInfo>& stateQueue, LabelStore& labelStore, FlightRecorder& flightRecorder)
 {
+	PROFILE_THREAD("Painting");
+
 	//Undo class
 	const size_t MAX_UNDO = 5;
 	//std::vector<unsigned char> trueColors = *colors.getRead();
 	UndoStackRef<unsigned char> undoStack(MAX_UNDO);
 
-	size_t lastHostTimestamp = 0;
-	size_t lastTimestamp = 0;
 	bool programStopped = false;
 
-	//Build KD Tree
-	vector<IndexVec3> vertIndexPair;
-	for (int i = 0; i < positions.size(); i++) {
-		vertIndexPair.push_back(IndexVec3(i, positions[i]));
-	}
-	using namespace spatial;
-	build_kdTree_inplace<dimensions<IndexVec3>()>(vertIndexPair.begin(), vertIndexPair.end());
+	//Working copy of the labels, published to the store after every change
+	std::vector<unsigned char> labels = labelStore.snapshot().toVector();
+
+	//Spatial index, built before the thread starts
+	vertexIndex.rebuildLabels(labels.data());
+
+	//Label and undo footprints, updated whenever a stroke or operation finishes
+	MemoryGauge labelMemory(MEMORY_LABELS);
+	MemoryGauge undoMemory(MEMORY_UNDO);
+	auto trackMemory = [&]() {
+		labelMemory.set(labels.capacity() + labelStore.memoryUsage());
+		undoMemory.set(undoStack.memoryUsage());
+	};
+	trackMemory();
+
+	//Geodesic brush
+	GeodesicBrush geodesicBrush(positions.size());
+	std::vector<IndexVec3> sphereNeighbours;
+	std::vector<uint32_t> reachedVertices;
+
+	//Kept between ticks so their capacity is reused
+	std::vector<IndexVec3> neighbours;
+	std::vector<IndexVec3> unfilteredNeighbours;
 
 	//
 	bool isPainting = false;
@@ -2289,40 +2363,75 @@ void paintingThreadFunc(std::vector<vec3>& positions, Resource<StateInfo, 3>::Re
 	std::vector<glm::vec3> lastPositions;		//Initial position well outside range
 	int lastColor = -1;
 
+	//Tick metrics
+	const double METRICS_INTERVAL = 10.0;		//Seconds
+	PaintingTickMetrics metrics;
+	auto metricsStart = std::chrono::steady_clock::now();
+
+	std::vector<StateInfo> pendingStates;
 	while (!programStopped) {
-		StateInfo currentState = *stateInfo.getRead();
-		programStopped = currentState.shouldClose;
-		ChangedRange newChangedRange;
-		if (currentState.timestamp > lastHostTimestamp) {
-			lastHostTimestamp = currentState.timestamp;
+		//Sleeps until the main thread queues a state, then takes every state
+		//queued since the last tick, oldest first
+		stateQueue.waitAndDrain(&pendingStates);
+		PROFILE_ZONE("Painting tick");
+		auto tickStart = std::chrono::steady_clock::now();
+		size_t allocationsStart = heapAllocationCount();
+
+		//Temporaries of the tick come from the arena, emptied at the start of each tick
+		threadFrameArena().reset();
+		ArenaVector<glm::vec3> batchPositions;
+		ArenaVector<PaintingBatch> batches;
+		batchPaintingStates(pendingStates, &batchPositions, &batches);
+		bool footprintChanged = false;
+		for (const PaintingBatch& batch : batches) {
+			const StateInfo& currentState = *batch.state;
+			programStopped |= currentState.shouldClose;
 			//PAINTING
 			{
-				std::vector<IndexVec3> neighbours;
-				for (vec3 controller : currentState.controllerPositions) {
-					vec3 pos = controller;
-					float searchRadius = currentState.scaledDrawRadius;
+				neighbours.clear();
+				if (batch.positionNum > 0 && !isPainting) {
+					undoStack.startNewState();
+					isPainting = true;
+					//No idle states arrive between strokes, so nothing from the last stroke is filtered
+					lastColor = currentState.drawColor;
+					lastRadius = currentState.scaledDrawRadius;
+				}
 
-					if (!isPainting) {
-						undoStack.startNewState();
-						isPainting = true;
+				//Every sample in one traversal. Subtrees that are all hidden or
+				//already the draw color are skipped.
+				if (!currentState.geodesicBrush) {
+					PROFILE_ZONE("Brush query");
+					float searchRadius = currentState.scaledDrawRadius;
+					vertexIndex.findNeighboursBatch(batch.controllerPositions, batch.positionNum,
+						searchRadius*searchRadius, neighbours, skippableLabels(currentState.visibility, currentState.drawColor));
+				}
+				else {
+					PROFILE_ZONE("Geodesic query");
+					for (size_t sample = 0; sample < batch.positionNum; sample++) {
+						vec3 pos = batch.controllerPositions[sample];
+						float searchRadius = currentState.scaledDrawRadius;
+
+						//Seed at the closest vertex inside the sphere and grow along the surface
+						size_t seed = vertexIndex.findNearest(pos, searchRadius*searchRadius);
+						if (seed == size_t(-1))
+							continue;
+
+						reachedVertices.clear();
+						geodesicBrush.query(seed, pos, searchRadius, positions.data(), adjacency, &reachedVertices);
+						for (uint32_t v : reachedVertices)
+							neighbours.push_back(IndexVec3(v, positions[v]));
 					}
-
-					kdTree_findNeighbours<dimensions<IndexVec3>()>(
-						vertIndexPair.begin(), vertIndexPair.end(),
-						IndexVec3(-1, pos),
-						searchRadius*searchRadius,
-						neighbours);
 				}
 				//if (currentState.controllerPositions.size() == 0) isPainting = false;
 
 				//----Filter out points colored in last stage----//
 
 				if (currentState.drawColor != lastColor) {
-					std::vector<IndexVec3> unfilteredNeighbours;
+					unfilteredNeighbours.clear();
 					unfilteredNeighbours.swap(neighbours);
 					for (auto vi : unfilteredNeighbours) {
-						for (auto lastPosition : currentState.controllerPositions) {
-							glm::vec3 vecToLastPosition = vi.point - lastPosition;
+						for (size_t sample = 0; sample < batch.positionNum; sample++) {
+							glm::vec3 vecToLastPosition = vi.point - batch.controllerPositions[sample];
 							if (dot(vecToLastPosition, vecToLastPosition) < lastRadius*lastRadius)
 								neighbours.push_back(vi);
 						}
@@ -2330,67 +2439,177 @@ void paintingThreadFunc(std::vector<vec3>& positions, Resource<StateInfo, 3>::Re
 				}
 
 				lastRadius = currentState.scaledDrawRadius;
-				lastPositions = currentState.controllerPositions;
+				lastPositions.assign(batch.controllerPositions, batch.controllerPositions + batch.positionNum);
 				lastColor = currentState.drawColor;
 				//----Filter out points colored in last stage----//
 
 				{
-					auto colorRead = colors.getRead();
-					for (int i = 0; i < neighbours.size(); i++) {
-						undoStack.modify(neighbours[i].index, currentState.drawColor, colorRead->data(), currentState.visibility);
-					}
-				}
-				if (neighbours.size()) {
-					newChangedRange.begin = undoStack.lowestIndex();
-					newChangedRange.end = undoStack.highestIndex()+1;
-				}
-				auto& changeMap = undoStack.getLastState();
-				{
-					auto writeResource = colors.getWrite();
-					for (const auto& iv : changeMap)
-						writeResource.data[iv.first] = iv.second.newValue;
+					PROFILE_ZONE("Apply brush");
+					applyBrush(neighbours, currentState.drawColor, currentState.visibility,
+						labels.data(), labels.size(), undoStack, labelStore);
+					vertexIndex.updateLabels(neighbours.begin(), neighbours.end(),
+						[](const IndexVec3& vi) { return vi.index; }, labels.data());
 				}
 				
 			}
 
 			//RELEASE
-			if (currentState.controllerPositions.size() == 0 && isPainting == true) {
+			if (batch.positionNum == 0 && isPainting == true) {
 				auto& changeMap = undoStack.getLastState();
-				for (int i = 0; i < 3; i++) {
-					auto writeResource = colors.getWriteSpecific(i, std::chrono::microseconds(100));
-					for (const auto& iv : changeMap)
-						writeResource.data[iv.first] = iv.second.newValue;
-				}
+				LabelTotals delta;
+				for (const auto& iv : changeMap)
+					labelStatistics.accumulate(&delta, iv.first, iv.second.oldValue, iv.second.newValue);
+				labelStatistics.commit(delta);
 				isPainting = false;
 				lastColor = -1;
 				lastRadius = 0.f;
-				lastPositions = {};
+				lastPositions.clear();
+				footprintChanged = true;
 			}
 			//UNDO and REDO
 			if (currentState.action == StateInfo::UNDO || currentState.action == StateInfo::REDO) {
-				std::map<size_t, unsigned char> changeMap;
+				ArenaMap<size_t, unsigned char> changeMap;
+				std::shared_ptr<const UndoOperation<unsigned char>> operation;
 				if (currentState.action == StateInfo::UNDO)
-					undoStack.undo(&changeMap);
+					undoStack.undo(&changeMap, &operation);
 				else
-					undoStack.redo(&changeMap);
+					undoStack.redo(&changeMap, &operation);
+
+				LabelTotals delta;
+				for (const auto& iv : changeMap)
+					labelStatistics.accumulate(&delta, iv.first, labels[iv.first], iv.second);
+				if (operation)
+					labelStatistics.accumulate(&delta, *operation, currentState.action == StateInfo::UNDO);
+				labelStatistics.commit(delta);
+
+				for (const auto& iv : changeMap) {
+					labels[iv.first] = iv.second;
+					labelStore.markChanged(iv.first);
+				}
+				if (operation) {
+					if (currentState.action == StateInfo::UNDO)
+						operation->revert(labels.data());
+					else
+						operation->apply(labels.data());
+					operation->forEachChange([&](size_t vertex, unsigned char, unsigned char) { labelStore.markChanged(vertex); });
+					vertexIndex.rebuildLabels(labels.data());
+				}
+				else
+					vertexIndex.updateLabels(changeMap.begin(), changeMap.end(),
+						[](const std::pair<const size_t, unsigned char>& iv) { return iv.first; }, labels.data());
+				footprintChanged = true;
+			}
+			//FILL, bulk label operations and morphology, using the label closest to the tool
+			if ((currentState.action == StateInfo::FILL
+				|| currentState.action == StateInfo::REPLACE
+				|| currentState.action == StateInfo::SWAP
+				|| currentState.action == StateInfo::CLEAR
+				|| currentState.action == StateInfo::DILATE
+				|| currentState.action == StateInfo::ERODE
+				|| currentState.action == StateInfo::SMOOTH) && !isPainting)
+			{
+				vec3 pos = currentState.toolPosition;
+				float searchRadius = currentState.scaledDrawRadius;
+				size_t seed = vertexIndex.findNearest(pos, searchRadius*searchRadius);
+				bool hasSeed = seed != size_t(-1);
+				std::shared_ptr<UndoOperation<unsigned char>> operation;
 
-				for (int i = 0; i < 3; i++) {
-					auto writeResource = colors.getWriteSpecific(i, std::chrono::microseconds(100));
-					for (const auto& iv : changeMap)
-						writeResource.data[iv.first] = iv.second;
+				{
+					unsigned char seedLabel = (hasSeed) ? labels[seed] : 0;
+
+					VertexSet scope;
+					if (currentState.labelScope == SCOPE_BRUSH) {
+						sphereNeighbours.clear();
+						vertexIndex.findNeighbours(pos, searchRadius*searchRadius, sphereNeighbours);
+						scope = VertexSet(positions.size());
+						for (const auto& vi : sphereNeighbours)
+							scope.set(vi.index);
+					}
+					else if (currentState.labelScope == SCOPE_REGION && hasSeed)
+						scope = findConnectedPiece(uint32_t(seed), adjacency);
+					else if (currentState.labelScope == SCOPE_REGION)
+						scope = VertexSet(positions.size());
+					const VertexSet* scopePtr = (currentState.labelScope == SCOPE_ALL) ? nullptr : &scope;
+
+					switch (currentState.action) {
+					case StateInfo::FILL:
+						if (hasSeed)
+							operation = floodFill(uint32_t(seed), currentState.drawColor, labels.data(),
+								adjacency, currentState.visibility);
+						break;
+					case StateInfo::REPLACE:
+						if (hasSeed)
+							operation = replaceLabel(seedLabel, currentState.drawColor, labels.data(), labels.size(),
+								currentState.visibility, scopePtr);
+						break;
+					case StateInfo::SWAP:
+						if (hasSeed)
+							operation = swapLabels(seedLabel, currentState.drawColor, labels.data(), labels.size(),
+								currentState.visibility, scopePtr);
+						break;
+					case StateInfo::CLEAR:
+						if (hasSeed)
+							operation = clearLabel(seedLabel, labels.data(), labels.size(),
+								currentState.visibility, scopePtr);
+						break;
+					case StateInfo::DILATE:
+						operation = dilateLabel(currentState.drawColor, currentState.morphologyRings, labels.data(),
+							adjacency, currentState.visibility, scopePtr);
+						break;
+					case StateInfo::ERODE:
+						operation = erodeLabel(currentState.drawColor, currentState.morphologyRings, labels.data(),
+							adjacency, currentState.visibility, scopePtr);
+						break;
+					case StateInfo::SMOOTH:
+						operation = smoothLabels(currentState.morphologyRings, labels.data(),
+							adjacency, currentState.visibility, scopePtr);
+						break;
+					}
 				}
 
-				newChangedRange.begin = 0;
-				newChangedRange.end = colors.getRead()->size();
+				if (operation) {
+					LabelTotals delta;
+					labelStatistics.accumulate(&delta, *operation, false);
+					labelStatistics.commit(delta);
+
+					operation->apply(labels.data());
+					operation->forEachChange([&](size_t vertex, unsigned char, unsigned char) { labelStore.markChanged(vertex); });
+					undoStack.pushOperation(operation);
+					vertexIndex.rebuildLabels(labels.data());
+					footprintChanged = true;
+				}
 			}
 
-			//changedRange
-			lastTimestamp++;
-			newChangedRange.timestamp = lastTimestamp;
-			*changedRange.getWrite() = newChangedRange;
+			//Labels under the tool, answered from the kd-tree's summaries when it is used
+			if (currentState.action == StateInfo::QUERY_LABELS) {
+				uint64_t present = vertexIndex.labelsInSphere(currentState.toolPosition,
+					currentState.scaledDrawRadius, labels.data());
+				printf("Labels under brush:");
+				for (int label = 0; label < 64; label++) {
+					if (present & (uint64_t(1) << label))
+						printf((label < 63) ? " %d" : " %d+", label);
+				}
+				printf("\n");
+			}
 		}
-		else {
-			std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+		//Pages changed this tick become visible together
+		{
+			PROFILE_ZONE("Publish labels");
+			labelStore.publish(labels.data());
+		}
+		if (footprintChanged)
+			trackMemory();
+
+		auto tickEnd = std::chrono::steady_clock::now();
+		flightRecorder.recordTick(pendingStates.size(), std::chrono::duration<double>(tickEnd - tickStart).count());
+		metrics.record(pendingStates.size(), batches.size(), std::chrono::duration<double>(tickEnd - tickStart).count(),
+			heapAllocationCount() - allocationsStart);
+		double interval = std::chrono::duration<double>(tickEnd - metricsStart).count();
+		if (interval >= METRICS_INTERVAL) {
+			metrics.print(interval);
+			metrics = PaintingTickMetrics();
+			metricsStart = tickEnd;
 		}
 	}
 
@@ -2414,12 +2633,8 @@ void paintingThreadFuncPinned(std::vector<vec3>& positions, Resource<StateInfo,
 	bool programStopped = false;
 
 	//Build KD Tree
-	vector<IndexVec3> vertIndexPair;
-	for (int i = 0; i < positions.size(); i++) {
-		vertIndexPair.push_back(IndexVec3(i, positions[i]));
-	}
-	using namespace spatial;
-	build_kdTree_inplace<dimensions<IndexVec3>()>(vertIndexPair.begin(), vertIndexPair.end());
+	VertexKDTree kdTree;
+	kdTree.build(positions.data(), positions.size());
 
 	//
 	bool isPainting = false;
@@ -2450,11 +2665,7 @@ void paintingThreadFuncPinned(std::vector<vec3>& positions, Resource<StateInfo,
 						isPainting = true;
 					}
 
-					kdTree_findNeighbours<dimensions<IndexVec3>()>(
-						vertIndexPair.begin(), vertIndexPair.end(),
-						IndexVec3(-1, pos),
-						searchRadius*searchRadius,
-						neighbours);
+					kdTree.findNeighbours(pos, searchRadius*searchRadius, neighbours);
 				}
 				//if (currentState.controllerPositions.size() == 0) isPainting = false;
 
@@ -2540,7 +2751,29 @@ void paintingThreadFuncPinned(std::vector<vec3>& positions, Resource<StateInfo,
 	printf("Drawing thread finished\n");
 }
 //*/
-void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* savedFile, int sampleNumber) {
+//Brush spheres in model space from the painting frames of a recorded draw
+//sequence, used to choose the vertex index
+void recordedBrushQueries(const char* filename, vec3 drawPositionModelspace, vector<vec3>* centers, vector<float>* radii) {
+	FILE* file = fopen(filename, "r");
+	if (file == nullptr)
+		return;
+	fclose(file);
+
+	for (const StateAtDraw& state : loadControllerSequence(filename)) {
+		mat4 model = translate(mat4(1.f), state.modelPosition)*mat4_cast(state.modelOrientation)
+			*scale(mat4(1.f), vec3(state.modelScale));
+		mat4 inverseModel = inverse(model);
+		for (int i = 0; i < 2; i++) {
+			if (!state.controllerPainting[i])
+				continue;
+			mat4 controller = translate(mat4(1.f), state.controllerPosition[i])*mat4_cast(state.controllerOrientation[i]);
+			centers->push_back(vec3(inverseModel*controller*vec4(drawPositionModelspace, 1.f)));
+			radii->push_back(state.brushRadius / state.modelScale);
+		}
+	}
+}
+
+void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* savedFile, int sampleNumber, bool weldOnImport) {
 	glfwSetCursorPosCallback(window, cursorPositionCallback);
 	glfwSetWindowSizeCallback(window, windowResizeCallback);
 
@@ -2566,7 +2799,12 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 
 	const int FRAMES_PER_SECOND = 90;
 
+	PROFILE_THREAD("Main");
+
 	//Load model
+#if ENABLE_PROFILER
+	uint64_t loadStarted = profilerNow();
+#endif
 	MeshInfoLoader minfo;
 	vector<unsigned char> colors;	// (minfo.vertices.size(), 0);
 	string objName;
@@ -2593,12 +2831,68 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 			savedFilename = savedFile;
 	}
 	else {
-		loadVolume(loadedFile, &minfo, &colors, &objName);
+		if (!loadVolume(loadedFile, &minfo, &colors, &objName)) {
+			printf("WindowManager::paintingLoopIndexedMT - Could not load %s\n", loadedFile);
+			vr::VR_Shutdown();
+			glfwTerminate();
+			return;
+		}
 		savedFilename = savedFile;
 	}
 
+	//Merge duplicated vertices. Labels are kept against the unwelded model in
+	//.clr files, so they are remapped here and unwelded again when saved.
+	vector<uint32_t> weldRemap;
+	if (weldOnImport) {
+		weldVertices(weldEpsilon(minfo.vertices), &minfo.vertices, &minfo.normals, &minfo.indices, &weldRemap);
+		remapLabels(weldRemap, minfo.vertices.size(), &colors);
+	}
+
+	//Compact vertices for drawing. Brush queries and ray picking search a
+	//decoded copy of the positions, so they work on the surface that is drawn,
+	//while saves and exports keep the loaded positions and normals.
+	QuantizedMesh quantizedMesh;
+	vector<vec3> decodedVertices;
+	if constexpr (QUANTIZE_VERTICES) {
+		quantizedMesh.encode(minfo.vertices.data(), minfo.normals.empty() ? nullptr : minfo.normals.data(), minfo.vertices.size());
+		decodedVertices = minfo.vertices;
+		quantizedMesh.decode(decodedVertices.data(), nullptr);
+		printf("Quantized vertices, positions within %f\n", quantizedMesh.maxPositionError());
+	}
+	vector<vec3>& searchVertices = (QUANTIZE_VERTICES) ? decodedVertices : minfo.vertices;
+#if ENABLE_PROFILER
+	profileRecord("Load model", loadStarted, profilerNow());
+#endif
+
 	printf("Number of vertices: %d\nNumber of faces: %d\n", minfo.vertices.size(), minfo.indices.size() / 3);
 
+	//Ray picking
+	MeshBVH meshBVH;
+	meshBVH.build(searchVertices.data(), minfo.indices.data(), minfo.indices.size() / 3);
+	bool rayBrush = false;		//Paint where the controller points instead of around the controller
+
+	//Mesh connectivity, cached next to the model
+	MeshAdjacency adjacency;
+	adjacency.buildCached(swapExtension(objName, "adj"),
+		minfo.indices.data(), minfo.indices.size() / 3, minfo.vertices.size());
+	bool geodesicBrush = false;
+	int labelScope = SCOPE_ALL;
+	int morphologyRings = 1;
+
+	//Per label counts and areas, updated by the painting thread
+	LabelStatistics labelStatistics;
+	labelStatistics.computeVertexAreas(minfo.vertices.data(), minfo.indices.data(), minfo.indices.size() / 3, minfo.vertices.size());
+	labelStatistics.recount(colors.data(), colors.size());
+
+	//Footprint of what was loaded. The labels loaded here are released once
+	//the label store and GPU buffers have their own copies.
+	MemoryGauge meshMemory(MEMORY_MESH);
+	meshMemory.set(minfo.vertices.capacity()*sizeof(vec3) + minfo.normals.capacity()*sizeof(vec3)
+		+ minfo.indices.capacity()*sizeof(unsigned int) + adjacency.memoryUsage() + weldRemap.capacity()*sizeof(uint32_t)
+		+ decodedVertices.capacity()*sizeof(vec3));
+	MemoryGauge loadedLabelMemory(MEMORY_LABELS);
+	loadedLabelMemory.set(colors.capacity() + labelStatistics.memoryUsage());
+
 	vec3 points[6] = {
 		//First triangle
 		vec3(-0.5f, 0.5f, 0.f)*2.f,
@@ -2720,7 +3014,7 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 	int COLOR_NUM = colorSet.size();
 	auto colorSetMat = make<ColorSetMat>(colorSet);
 
-	VRColorShaderBin colorShader(colorSet.size());
+	VRColorShaderBin colorShader(colorSet.size(), QUANTIZE_VERTICES);
 	ColorWheelShaderBin colorWheelShader(colorSet.size());
 
 	enum {
@@ -2728,12 +3022,23 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 	};
 
 	constexpr bool USING_PINNED = false;
+	static_assert(!QUANTIZE_VERTICES || !USING_PINNED, "Quantized vertices have their own color buffer, not a pinned one");
 
 	auto mcGeometry = make<IndexGeometryUint<attrib::Position, attrib::Normal, attrib::ColorIndex>>();
+	QuantizedGeometry quantizedGeometry;
+	MemoryGauge gpuMemory(MEMORY_GPU);
 	auto mcGeometryPinned = make<MarchingCubesGeometry>(minfo.vertices.size());
-	if constexpr (!USING_PINNED) {
+	if constexpr (QUANTIZE_VERTICES) {
+		quantizedGeometry.load(quantizedMesh, colors.data(), minfo.indices.data(), minfo.indices.size());
+		quantizedMesh = QuantizedMesh();
+		gpuMemory.set(quantizedGeometry.memoryUsage());
+		//mcGeometry stays empty, the drawable only carries the materials and transform
+		drawables.push_back(Drawable(mcGeometry, make_shared<ShadedMat>(0.4, 0.7, 0.6, 10.f /*0.4, 0.5, 0.5, 10.f*/)));
+	}
+	else if constexpr (!USING_PINNED) {
 		mcGeometry->loadIndices(minfo.indices.data(), minfo.indices.size());
 		mcGeometry->loadBuffers(minfo.vertices.data(), minfo.normals.data(), colors.data(), minfo.vertices.size());
+		gpuMemory.set(minfo.vertices.size()*(2 * sizeof(vec3) + sizeof(unsigned char)) + minfo.indices.size()*sizeof(unsigned int));
 		drawables.push_back(Drawable(mcGeometry, make_shared<ShadedMat>(0.4, 0.7, 0.6, 10.f /*0.4, 0.5, 0.5, 10.f*/)));
 	}
 	else{
@@ -2815,12 +3120,42 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 
 	//Setup painting thread
 	Resource<StateInfo, 3> stateResource;
-	Resource<std::vector<unsigned char>, 3> colorResource(colors);
+	WorkQueue<StateInfo> stateQueue;		//Every frame's state, so the painting thread drops none
+	LabelStore labelStore(colors);
 	Resource<ChangedRange, 3> rangeResource;
+	vector<unsigned char>().swap(colors);
+	loadedLabelMemory.set(labelStatistics.memoryUsage());
+
+	//Last ten seconds of frames, written out a second after a frame that
+	//missed a vsync or when H is pressed
+	FlightRecorder flightRecorder(10 * FRAMES_PER_SECOND, FRAMES_PER_SECOND,
+		FLIGHT_HITCH_PERIODS*1000.f / float(FRAMES_PER_SECOND));
+	size_t flightDumps = 0;
+	bool flightDumpPending = false;
+
+	//Vertex index for brush queries, timed on the recorded strokes if there are any
+	vector<vec3> recordedCenters;
+	vector<float> recordedRadii;
+	recordedBrushQueries("DrawSequence.seq", drawPositionModelspace, &recordedCenters, &recordedRadii);
+	unique_ptr<VertexIndex> vertexIndex = createVertexIndex(VERTEX_INDEX_TYPE, searchVertices.data(), searchVertices.size(),
+		recordedCenters, recordedRadii, drawRadius / sceneTransform.scale);
+
+	MemoryGauge indexMemory(MEMORY_SPATIAL_INDEX);
+	indexMemory.set(vertexIndex->memoryUsage() + meshBVH.memoryUsage());
+
+	//Speedup of the largest brush from one thread to one per core
+	constexpr bool BENCHMARK_BRUSH_SCALING = false;
+	if constexpr (BENCHMARK_BRUSH_SCALING)
+		benchmarkBrushScaling(*vertexIndex, searchVertices.data(), searchVertices.size(), 0.2f / sceneTransform.scale, 100);
+
+	//Printed before the painting thread starts setting up its own gauges
+	printMemoryReport("Loaded");
+
 	std::thread paintingThread;
 	if constexpr (!USING_PINNED){
 		paintingThread = std::thread(paintingThreadFunc, 
-			std::ref(minfo.vertices), stateResource.createReader(), std::ref(colorResource), std::ref(rangeResource));
+			std::ref(searchVertices), std::cref(adjacency), std::ref(*vertexIndex), std::ref(labelStatistics),
+			std::ref(stateQueue), std::ref(labelStore), std::ref(flightRecorder));
 	}
 	else {
 		paintingThread = std::thread(paintingThreadFuncPinned,
@@ -2832,6 +3167,7 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 	//*/
 	size_t timestamp = 0;
 	size_t paintingTimestamp = 0;
+	uint64_t uploadedLabelEpoch = labelStore.epoch();
 
 	//Set initial controler state
 	devices.updateState(vrContext.vrSystem);
@@ -2839,6 +3175,16 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 	std::vector<StateAtDraw> stateAtDraw;
 	std::vector<StateAtDraw> replayState;
 
+	//Stage timing is printed every ten seconds
+	FramePipeline framePipeline(2, 10 * FRAMES_PER_SECOND);
+	FramePipeline::Stage inputStage = framePipeline.addStage("Query input", STAGE_MAIN);
+	FramePipeline::Stage publishStage = framePipeline.addStage("Publish state", STAGE_MAIN);
+	FramePipeline::Stage uploadStage = framePipeline.addStage("Load colors", STAGE_MAIN);
+	FramePipeline::Stage fogStage = framePipeline.addStage("Fog bounds", STAGE_WORKER);
+	FramePipeline::Stage renderStage = framePipeline.addStage("Render", STAGE_MAIN);
+	FramePipeline::Stage submitStage = framePipeline.addStage("Submit frame", STAGE_MAIN);
+	FramePipeline::Stage saveStage = framePipeline.addStage("Save", STAGE_WORKER);
+
 	while (!glfwWindowShouldClose(window)) {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -2861,6 +3207,7 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		vec2 trackpadDir[4] = { vec2(0, 1), vec2(1, 0), vec2(0, -1), vec2(-1, 0) };
 
 		pushDebugGroup("Query input");
+		framePipeline.begin(inputStage);
 		//Update colormap
 		static bool updateMapButtonPressed = false;
 		if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !updateMapButtonPressed) {
@@ -2873,10 +3220,28 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 
 		static bool saveColoredPLYButton = false;
 		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS && !saveColoredPLYButton) {
+			saveColoredPLYButton = true;
+			bool compacted = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS
+				|| glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
 			printf("Saving colored ply\n");
 			if constexpr (!USING_PINNED) {
-				createPLYWithColors("coloredModel.ply", minfo.indices.data(), minfo.indices.size() / 3, minfo.vertices.data(), minfo.normals.data(),
-					colorResource.getRead().data.data(), colorSet.data(), minfo.vertices.size(), colorSetMat->visibility);
+				LabelStore::Snapshot savedLabels = labelStore.snapshot();
+				Bitmask visibility = colorSetMat->visibility;
+				//Anything C or later frames can reassign is copied into the job
+				framePipeline.run(saveStage, [&, savedLabels, visibility, compacted, colorSet]() {
+					MemoryCharge ioMemory(MEMORY_IO, savedLabels.size());
+					std::vector<unsigned char> savedColors = savedLabels.toVector();
+					if (compacted) {
+						//Drops hidden points entirely instead of only their faces
+						string clrFilename = createCompactedPLY("compactedModel.ply", minfo.indices.data(), minfo.indices.size() / 3,
+							minfo.vertices.data(), minfo.normals.data(), savedColors.data(), colorSet.data(),
+							minfo.vertices.size(), visibility);
+						printf("Saved compactedModel.ply and %s\n", clrFilename.c_str());
+					}
+					else
+						createPLYWithColors("coloredModel.ply", minfo.indices.data(), minfo.indices.size() / 3, minfo.vertices.data(), minfo.normals.data(),
+							savedColors.data(), colorSet.data(), minfo.vertices.size(), visibility);
+				});
 			}
 			else {
 				createPLYWithColors(
@@ -2894,6 +3259,77 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		else if (glfwGetKey(window, GLFW_KEY_S) == GLFW_RELEASE)
 			saveColoredPLYButton = false;
 
+		//Export each label, or with shift each connected component, to its own ply
+		static bool exportSegmentsButton = false;
+		if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS && !exportSegmentsButton && !USING_PINNED) {
+			exportSegmentsButton = true;
+			bool byComponent = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS
+				|| glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
+			printf("Exporting %s\n", (byComponent) ? "components" : "labels");
+			LabelStore::Snapshot exportedLabels = labelStore.snapshot();
+			Bitmask visibility = colorSetMat->visibility;
+			framePipeline.run(saveStage, [&, exportedLabels, visibility, byComponent, colorSet, savedFilename]() {
+				MemoryCharge ioMemory(MEMORY_IO, exportedLabels.size());
+				std::vector<unsigned char> exportedColors = exportedLabels.toVector();
+				exportLabelSegments(savedFilename.substr(0, savedFilename.find_last_of('.')),
+					(byComponent) ? GROUP_BY_COMPONENT : GROUP_BY_LABEL,
+					minfo.indices.data(), minfo.indices.size() / 3, minfo.vertices.data(), minfo.normals.data(),
+					exportedColors.data(), colorSet.data(), colorSet.size(), minfo.vertices.size(), visibility);
+			});
+		}
+		else if (glfwGetKey(window, GLFW_KEY_E) == GLFW_RELEASE)
+			exportSegmentsButton = false;
+
+		static bool rayBrushButtonPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && !rayBrushButtonPressed) {
+			rayBrushButtonPressed = true;
+			rayBrush = !rayBrush;
+			printf("Ray brush %s\n", (rayBrush) ? "enabled" : "disabled");
+		}
+		else if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+			rayBrushButtonPressed = false;
+
+		static bool geodesicButtonPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !geodesicButtonPressed) {
+			geodesicButtonPressed = true;
+			geodesicBrush = !geodesicBrush;
+			printf("Geodesic brush %s\n", (geodesicBrush) ? "enabled" : "disabled");
+		}
+		else if (glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE)
+			geodesicButtonPressed = false;
+
+		static bool scopeButtonPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && !scopeButtonPressed) {
+			scopeButtonPressed = true;
+			labelScope = (labelScope + 1) % SCOPE_NUM;
+			printf("Label operations apply to %s\n", labelScopeName(labelScope));
+		}
+		else if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+			scopeButtonPressed = false;
+
+		static bool ringsButtonPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS && !ringsButtonPressed) {
+			ringsButtonPressed = true;
+			morphologyRings = std::max(1, morphologyRings - 1);
+			printf("Grow, shrink and smooth by %d rings\n", morphologyRings);
+		}
+		else if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS && !ringsButtonPressed) {
+			ringsButtonPressed = true;
+			morphologyRings++;
+			printf("Grow, shrink and smooth by %d rings\n", morphologyRings);
+		}
+		else if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_RELEASE
+			&& glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_RELEASE)
+			ringsButtonPressed = false;
+
+		static bool benchmarkButtonPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && !benchmarkButtonPressed) {
+			benchmarkButtonPressed = true;
+			benchmarkRayCasts(meshBVH, searchVertices.data(), searchVertices.size());
+		}
+		else if (glfwGetKey(window, GLFW_KEY_B) == GLFW_RELEASE)
+			benchmarkButtonPressed = false;
+
 		const float MIN_TILT = (controllerHasTrackpad) ? 0.3f : 0.1f;	//Minimum offset from center for trackpads and joysticks
 
 		//Change color based on axis
@@ -2971,6 +3407,7 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 			released_TrackpadRadius = true;
 		}
 
+		framePipeline.end(inputStage);
 		glPopDebugGroup();	//Query input
 
 		/////////////////
@@ -3016,12 +3453,24 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		StateInfo newStateInfo(timestamp);
 		//printf("-------Client %d-------\n", timestamp);
 		pushDebugGroup("Search neighbours");
-		vector<IndexVec3> neighbours;
+		framePipeline.begin(publishStage);
+		vec3 brushPosition[2];
 		for (int i = 0; i < 2; i++) {
+			brushPosition[i] = vec3(controllers[i].getTransform()*vec4(drawPositionModelspace, 1.f));
 			if (controllers[i].input.getActivation(SPHERE_DISPLAY_CONTROL)) {
-				vec3 pos = vec3(controllers[i].getTransform()*vec4(drawPositionModelspace, 1.f)); // TODO: write better code
+				vec3 pos = brushPosition[i]; // TODO: write better code
 				mat4 invrsTrans = inverse(sceneTransform.getTransform());
 				pos = vec3(invrsTrans*vec4(pos, 1));
+
+				//Move brush to the first surface along the controller's pointing direction
+				if (rayBrush) {
+					vec3 direction = vec3(invrsTrans*controllers[i].getTransform()*vec4(0.f, 0.f, -1.f, 0.f));
+					RayHit hit = meshBVH.intersect(pos, normalize(direction));
+					if (hit.hit()) {
+						pos = pos + normalize(direction)*hit.t;
+						brushPosition[i] = vec3(sceneTransform.getTransform()*vec4(pos, 1.f));
+					}
+				}
 				
 				paintingButtonPressed[i] = 
 					controllers[i].input.getScalar(PAINT_CONTROL) > 0.95f;
@@ -3053,24 +3502,67 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		else if (pressed) {
 			redoButtonPressed = true;
 		}
+		//Fill, relabel or list labels using the right controller's brush
+		const int LABEL_KEY_NUM = 8;
+		const int labelKeys[LABEL_KEY_NUM] = { GLFW_KEY_F, GLFW_KEY_X, GLFW_KEY_W, GLFW_KEY_DELETE, GLFW_KEY_L,
+			GLFW_KEY_EQUAL, GLFW_KEY_MINUS, GLFW_KEY_M };
+		const int labelActions[LABEL_KEY_NUM] = { StateInfo::FILL, StateInfo::REPLACE, StateInfo::SWAP, StateInfo::CLEAR, StateInfo::QUERY_LABELS,
+			StateInfo::DILATE, StateInfo::ERODE, StateInfo::SMOOTH };
+		static bool labelButtonPressed[LABEL_KEY_NUM] = {};
+		for (int i = 0; i < LABEL_KEY_NUM; i++) {
+			if (glfwGetKey(window, labelKeys[i]) == GLFW_PRESS && !labelButtonPressed[i]) {
+				labelButtonPressed[i] = true;
+				newStateInfo.action = labelActions[i];
+				newStateInfo.toolPosition = vec3(inverse(sceneTransform.getTransform())
+					*vec4(brushPosition[VRControllerHand::RIGHT], 1.f));
+				newStateInfo.scaledDrawRadius = drawRadius / sceneTransform.scale;
+				newStateInfo.drawColor = drawColor;
+				newStateInfo.labelScope = labelScope;
+				newStateInfo.morphologyRings = morphologyRings;
+			}
+			else if (glfwGetKey(window, labelKeys[i]) == GLFW_RELEASE)
+				labelButtonPressed[i] = false;
+		}
 		timestamp++;
 		newStateInfo.timestamp = timestamp;
 		newStateInfo.visibility = colorSetMat->visibility;
+		newStateInfo.geodesicBrush = geodesicBrush;
 		stateResource.getWrite().data = newStateInfo;
-
+		//Idle frames are left out so the painting thread can sleep, except
+		//the first one after a stroke, which releases it
+		static bool strokeQueued = false;
+		if (!newStateInfo.controllerPositions.empty() || newStateInfo.action != -1 || strokeQueued)
+			stateQueue.push(newStateInfo);
+		strokeQueued = !newStateInfo.controllerPositions.empty();
+
+		framePipeline.end(publishStage);
 		glPopDebugGroup();		//Search neighbours
 		//Upload updated colors
 		/*********** LOADBUFFER************/
 		if(!USING_PINNED)
 		{
 			pushDebugGroup("Load colors");
-			auto newRange = rangeResource.getRead();
-			if(newRange.data.timestamp > paintingTimestamp && newRange.data.end > newRange.data.begin){
-				auto latestColorBuffer = colorResource.getRead();
-				mcGeometry->loadSubBuffer<attrib::ColorIndex>(
-					(unsigned char*)&latestColorBuffer.data[newRange.data.begin], 
-					newRange.data.begin, newRange.data.end - newRange.data.begin);
+			framePipeline.begin(uploadStage);
+			//Only pages published since the last upload
+			if (labelStore.epoch() > uploadedLabelEpoch) {
+				LabelStore::Snapshot latestLabels = labelStore.snapshot();
+				FlightFrame& flightFrame = flightRecorder.current();
+				for (size_t p = 0; p < latestLabels.pageCount(); p++) {
+					if (latestLabels.pageEpoch(p) > uploadedLabelEpoch) {
+						if constexpr (QUANTIZE_VERTICES)
+							quantizedGeometry.loadColors((unsigned char*)latestLabels.page(p),
+								p*LabelStore::PAGE_SIZE, latestLabels.pageLength(p));
+						else
+							mcGeometry->loadSubBuffer<attrib::ColorIndex>(
+								(unsigned char*)latestLabels.page(p),
+								p*LabelStore::PAGE_SIZE, latestLabels.pageLength(p));
+						flightFrame.uploadedPages++;
+						flightFrame.uploadedBytes += uint32_t(latestLabels.pageLength(p));
+					}
+				}
+				uploadedLabelEpoch = latestLabels.epoch();
 			}
+			framePipeline.end(uploadStage);
 			glPopDebugGroup();	//Load colors
 		}
 		//Update color wheel position
@@ -3078,26 +3570,22 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		colorWheel.orientation = controllers[0].orientation;
 
 		//Update sphere positions
-		drawingSphere[0].position = vec3(controllers[0].getTransform()*vec4(drawPositionModelspace, 1.f));	//controllers[0].position;
-		drawingSphere[1].position = vec3(controllers[1].getTransform()*vec4(drawPositionModelspace, 1.f));	//controllers[1].position;
+		drawingSphere[0].position = brushPosition[0];
+		drawingSphere[1].position = brushPosition[1];
 
-		pushDebugGroup("Distance to convex hull");
-		//Update bounding sphere on model and find fog bounds
-		float closestPoint = std::numeric_limits<float>::max();
-		float furthestPoint = -std::numeric_limits<float>::max();
+		//Fog bounds are found on the fog stage while the rest of the frame is set up
 		mat4 invModelMatrix = inverse(sceneTransform.getTransform());
 		vec3 cameraPosition = vec3(invModelMatrix*vec4(devices.hmd.leftEye.getPosition(), 1));
-
-		std::pair<float, float> distPair = getClosestAndFurthestDistanceToConvexHull(
-			cameraPosition,
-			convexHullMesh.vertices.data(),
-			convexHullMesh.vertices.size(),
-			convexHullMesh.indices.data(),
-			convexHullMesh.indices.size() / 3);
-
-		float fogDistance = distPair.first*sceneTransform.scale;
-		float fogScale = (distPair.second - distPair.first)*0.5f*sceneTransform.scale;
-		glPopDebugGroup();		//Distance to convex hull
+		float fogModelScale = sceneTransform.scale;
+		std::pair<float, float> distPair;
+		framePipeline.run(fogStage, [&]() {
+			distPair = getClosestAndFurthestDistanceToConvexHull(
+				cameraPosition,
+				convexHullMesh.vertices.data(),
+				convexHullMesh.vertices.size(),
+				convexHullMesh.indices.data(),
+				convexHullMesh.indices.size() / 3);
+		});
 
 
 
@@ -3175,32 +3663,28 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		else if (controllers[VRControllerHand::RIGHT].input.getActivation(SAVE_DRAW_SEQUENCE))
 			saveStatePressed = false;
 
-		if (savingState) 
-		{
-			stateAtDraw.push_back(StateAtDraw());
-			stateAtDraw.back().leftCamera = devices.hmd.leftEye.getCameraMatrix();
-			stateAtDraw.back().rightCamera = devices.hmd.rightEye.getCameraMatrix();
-		
-			stateAtDraw.back().brushRadius = drawRadius;
-			stateAtDraw.back().drawColor = drawColor;
+		//This frame's sample, kept by the flight recorder and by a recording sequence
+		StateAtDraw& drawState = flightRecorder.current().state;
+		drawState.leftCamera = devices.hmd.leftEye.getCameraMatrix();
+		drawState.rightCamera = devices.hmd.rightEye.getCameraMatrix();
 
-			stateAtDraw.back().modelPosition = drawables[0].getPos();
-			stateAtDraw.back().modelOrientation = drawables[0].getOrientationQuat();
-			stateAtDraw.back().modelScale = sceneTransform.scale;
+		drawState.brushRadius = drawRadius;
+		drawState.drawColor = drawColor;
 
-			stateAtDraw.back().controllerPosition[0] = controllers[0].getPos();
-			stateAtDraw.back().controllerOrientation[0] = controllers[0].getOrientationQuat();
-			stateAtDraw.back().controllerPainting[0] = paintingButtonPressed[0];
+		drawState.modelPosition = drawables[0].getPos();
+		drawState.modelOrientation = drawables[0].getOrientationQuat();
+		drawState.modelScale = sceneTransform.scale;
 
-			stateAtDraw.back().controllerPosition[1] = controllers[1].getPos();
-			stateAtDraw.back().controllerOrientation[1] = controllers[1].getOrientationQuat();
-			stateAtDraw.back().controllerPainting[1] = paintingButtonPressed[1];
-			
-			//stateAtDraw.back().modelTransform = drawables[0].getTransform();
-			//stateAtDraw.back().controller[0] = controllers[0].getTransform();
-			//stateAtDraw.back().controller[1] = controllers[1].getTransform();
-			savingState = true;
-		}
+		drawState.controllerPosition[0] = controllers[0].getPos();
+		drawState.controllerOrientation[0] = controllers[0].getOrientationQuat();
+		drawState.controllerPainting[0] = paintingButtonPressed[0];
+
+		drawState.controllerPosition[1] = controllers[1].getPos();
+		drawState.controllerOrientation[1] = controllers[1].getOrientationQuat();
+		drawState.controllerPainting[1] = paintingButtonPressed[1];
+
+		if (savingState)
+			stateAtDraw.push_back(drawState);
 
 		//replayState.pop_back();
 		static bool loadStatePressed = false;
@@ -3217,9 +3701,16 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		else if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
 			loadStatePressed = false;
 
+		pushDebugGroup("Distance to convex hull");
+		framePipeline.wait(fogStage);
+		float fogDistance = distPair.first*fogModelScale;
+		float fogScale = (distPair.second - distPair.first)*0.5f*fogModelScale;
+		glPopDebugGroup();		//Distance to convex hull
+
 		////////////
 		// DRAWING
 		///////////
+		framePipeline.begin(renderStage);
 		glLineWidth(10.f);
 		glEnable(GL_MULTISAMPLE);
 		glEnable(GL_CULL_FACE);
@@ -3236,9 +3727,14 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		for (int i = 0; i < 2; i++)
 			bpTexShader.draw(devices.hmd.leftEye, devices.hmd.rightEye, lightPos, controllers[i]);
 		for (int i = 0; i < drawables.size(); i++) {
-			colorShader.drawNew(devices.hmd.leftEye, devices.hmd.rightEye, lightPos,
-				fogScale, fogDistance,
-				vec3(0.02f, 0.04f, 0.07f), drawables[i]);		//Add lightPos and colorMat checking
+			if constexpr (QUANTIZE_VERTICES)
+				colorShader.drawQuantized(devices.hmd.leftEye, devices.hmd.rightEye, lightPos,
+					fogScale, fogDistance,
+					vec3(0.02f, 0.04f, 0.07f), drawables[i], quantizedGeometry);
+			else
+				colorShader.drawNew(devices.hmd.leftEye, devices.hmd.rightEye, lightPos,
+					fogScale, fogDistance,
+					vec3(0.02f, 0.04f, 0.07f), drawables[i]);		//Add lightPos and colorMat checking
 		}
 		if (displayColorWheel) {
 			colorWheelShader.draw(
@@ -3273,8 +3769,10 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		texShader.draw(cam, windowSquare);
 
 		checkGLErrors("Before submit");
+		framePipeline.end(renderStage);
 
 		//Draw headset
+		framePipeline.begin(submitStage);
 		pushDebugGroup("Submit frame");
 		vrContext.submitFrame(fbDraw);
 		glPopDebugGroup();	//Submit frame
@@ -3285,6 +3783,7 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 		pushDebugGroup("Update state");
 		devices.updateState(vrContext.vrSystem);
 		glPopDebugGroup();
+		framePipeline.end(submitStage);
 
 		//Get time
 		static double lastTime = 0.f;
@@ -3330,25 +3829,43 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 
 		static bool saveButtonPressed = false;
 		if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !saveButtonPressed) {
-			//if (saveVolume(savedFilename.c_str(), objName.c_str(), streamGeometry->vboPointer<COLOR>(), colors.size()))
-			if (!USING_PINNED && saveVolume(savedFilename.c_str(), objName.c_str(), colorResource.getRead().data.data(), colors.size()))
-				printf("Saved %s successfully\n", savedFilename.c_str());
-			else if (saveVolume(savedFilename.c_str(), objName.c_str(),
-				mcGeometryPinned->pinnedData.getRead()->get<attrib::Pinned<attrib::ColorIndex>>(),
-				colors.size()))
-			{
-				printf("Saved %s successfully\n", savedFilename.c_str());
+			if constexpr (!USING_PINNED) {
+				//Written from a snapshot on the save stage, so painting carries on meanwhile
+				LabelStore::Snapshot savedLabels = labelStore.snapshot();
+				framePipeline.run(saveStage, [&, savedLabels, colorSet, savedFilename, objName]() {
+					MemoryCharge ioMemory(MEMORY_IO, savedLabels.size());
+					std::vector<unsigned char> savedColors = savedLabels.toVector();
+					if (!weldRemap.empty())
+						savedColors = unweldLabels(weldRemap, savedColors.data());
+					if (saveVolume(savedFilename.c_str(), objName.c_str(), savedColors.data(), savedColors.size()))
+						printf("Saved %s successfully\n", savedFilename.c_str());
+					else {
+						printf("Attempting fallback - Saving to fallback.clr...\n");
+						if (saveVolume("fallback.clr", objName.c_str(), savedColors.data(), savedColors.size()))
+							printf("Saved fallback.clr successfully\n");
+					}
+					if (labelStatistics.save(swapExtension(savedFilename, "csv"), colorSet.data(), colorSet.size()))
+						printf("Saved label statistics to %s\n", swapExtension(savedFilename, "csv").c_str());
+				});
 			}
 			else {
-				printf("Attempting fallback - Saving to fallback.clr...\n");
-				//if (saveVolume("fallback.clr", objName.c_str(), streamGeometry->vboPointer<COLOR>(), colors.size()))
-				if(!USING_PINNED && saveVolume("fallback.clr", objName.c_str(), colorResource.getRead().data.data(), colors.size()))
-					printf("Saved fallback.clr successfully\n");
-				else if (saveVolume("fallback.clr", objName.c_str(),
-					mcGeometryPinned->pinnedData.getRead()->get<attrib::Pinned<attrib::ColorIndex>>(),
-					colors.size()))
+				//if (saveVolume(savedFilename.c_str(), objName.c_str(), streamGeometry->vboPointer<COLOR>(), colors.size()))
+				const unsigned char* pinnedColors = mcGeometryPinned->pinnedData.getRead()->get<attrib::Pinned<attrib::ColorIndex>>();
+				std::vector<unsigned char> savedColors;
+				if (!weldRemap.empty())
+					savedColors = unweldLabels(weldRemap, pinnedColors);
+				else
+					savedColors.assign(pinnedColors, pinnedColors + minfo.vertices.size());
+				if (saveVolume(savedFilename.c_str(), objName.c_str(), savedColors.data(), savedColors.size()))
 				{
-					printf("Saved fallback.clr successfully\n");
+					printf("Saved %s successfully\n", savedFilename.c_str());
+				}
+				else {
+					printf("Attempting fallback - Saving to fallback.clr...\n");
+					if (saveVolume("fallback.clr", objName.c_str(), savedColors.data(), savedColors.size()))
+					{
+						printf("Saved fallback.clr successfully\n");
+					}
 				}
 			}
 			saveButtonPressed = true;
@@ -3359,13 +3876,66 @@ void WindowManager::paintingLoopIndexedMT(const char* loadedFile, const char* sa
 
 		glPopDebugGroup();	//Start client frame
 
+		framePipeline.endFrame();
+		PROFILE_FRAME();
+
+		//Flight recorder, written on the save stage so the dump doesn't add a hitch of its own
+		FlightFrame& flightFrame = flightRecorder.current();
+		for (FramePipeline::Stage stage = 0; stage < std::min(framePipeline.stageCount(), MAX_FLIGHT_STAGES); stage++)
+			flightFrame.stageMs[stage] = float(framePipeline.lastSeconds(stage)*1000.0);
+		flightDumpPending |= flightRecorder.endFrame();
+
+		static bool memoryReportPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS && !memoryReportPressed) {
+			printMemoryReport("Requested");
+			memoryReportPressed = true;
+		}
+		else if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE)
+			memoryReportPressed = false;
+
+		static bool flightDumpPressed = false;
+		if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS && !flightDumpPressed) {
+			flightDumpPending = true;
+			flightDumpPressed = true;
+		}
+		else if (glfwGetKey(window, GLFW_KEY_H) == GLFW_RELEASE)
+			flightDumpPressed = false;
+
+		//Waits for the save stage to be idle so dumps never hold up a save
+		if (flightDumpPending && framePipeline.idle(saveStage)) {
+			std::vector<FlightFrame> flightFrames = flightRecorder.recentFrames();
+			std::vector<std::string> stageNames;
+			for (FramePipeline::Stage stage = 0; stage < framePipeline.stageCount(); stage++)
+				stageNames.push_back(framePipeline.stageName(stage));
+			size_t hitches = flightRecorder.hitchCount();
+			string basename = "saved/flight" + std::to_string(flightDumps % FLIGHT_DUMP_FILES);
+			framePipeline.run(saveStage, [flightFrames, stageNames, hitches, basename]() {
+				MemoryCharge ioMemory(MEMORY_IO, flightFrames.capacity()*sizeof(FlightFrame));
+				if (writeFlightRecord(basename, flightFrames, stageNames))
+					printf("Saved flight record %s.seq, %zu hitches so far\n", basename.c_str(), hitches);
+			});
+			flightDumps++;
+			flightDumpPending = false;
+		}
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
+	framePipeline.waitAll();
+	//Before the painting thread stops and its gauges go with it
+	printMemoryReport("Exit");
 	stateResource.getWrite().data.shouldClose = true;
+	stateQueue.push(StateInfo(true));
 	paintingThread.join();
 
+#if ENABLE_PROFILER
+	//The last PROFILE_RING_SIZE zones of every thread
+	std::vector<ProfileThreadEvents> profile = collectProfileEvents();
+	if (writeProfileTrace("saved/profile.json", profile) && writeProfileCSV("saved/profile.csv", profile))
+		printf("Saved profile to saved/profile.json and saved/profile.csv\n");
+#endif
+
 	glfwTerminate();
 	vr::VR_Shutdown();
 }
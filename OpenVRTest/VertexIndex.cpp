@@ -0,0 +1,100 @@
+#include "VertexIndex.h"
+#include "VertexKDTree.h"
+#include "SpatialGrid.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+//Queries timed per index, repeating the recorded ones as needed
+const size_t BENCHMARK_QUERY_NUM = 20000;
+
+}
+
+uint64_t skippableLabels(Bitmask hidden, int drawColor) {
+	uint64_t mask = 0;
+	for (unsigned int label = 0; label < 63; label++) {
+		if (hidden.test(label))
+			mask |= uint64_t(1) << label;
+	}
+	if (drawColor >= 0 && drawColor < 63)
+		mask |= uint64_t(1) << drawColor;
+	return mask;
+}
+
+//Answers each sphere on its own and removes repeated vertices
+void VertexIndex::findNeighboursBatch(const vec3* centers, size_t centerNum, float radiusSquared,
+	vector<IndexVec3>& neighbours, uint64_t skipMask) const
+{
+	size_t first = neighbours.size();
+	for (size_t i = 0; i < centerNum; i++)
+		findNeighbours(centers[i], radiusSquared, neighbours, skipMask);
+	if (centerNum < 2)
+		return;
+	sort(neighbours.begin() + first, neighbours.end(),
+		[](const IndexVec3& a, const IndexVec3& b) { return a.index < b.index; });
+	neighbours.erase(unique(neighbours.begin() + first, neighbours.end(),
+		[](const IndexVec3& a, const IndexVec3& b) { return a.index == b.index; }), neighbours.end());
+}
+
+double benchmarkVertexIndex(const VertexIndex& index, const vector<vec3>& centers, const vector<float>& radii) {
+	if (centers.empty())
+		return 0.0;
+
+	vector<IndexVec3> neighbours;
+	size_t found = 0;
+	auto start = chrono::high_resolution_clock::now();
+	for (size_t q = 0; q < std::max(BENCHMARK_QUERY_NUM, centers.size()); q++) {
+		size_t i = q % centers.size();
+		neighbours.clear();
+		index.findNeighbours(centers[i], radii[i] * radii[i], neighbours);
+		found += neighbours.size();
+	}
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+	printf("VertexIndex::benchmark - %s answered %zu queries (%zu vertices) in %.3f ms (%.1f MB)\n",
+		index.name(), std::max(BENCHMARK_QUERY_NUM, centers.size()), found, seconds*1000.0,
+		double(index.memoryUsage()) / (1024.0*1024.0));
+	return seconds;
+}
+
+unique_ptr<VertexIndex> createVertexIndex(VertexIndexType type, const vec3* positions, size_t pointNum,
+	const vector<vec3>& centers, const vector<float>& radii, float defaultRadius)
+{
+	float cellSize = defaultRadius;
+	if (!radii.empty()) {
+		vector<float> sorted = radii;
+		nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+		cellSize = sorted[sorted.size() / 2];
+	}
+
+	if (type == INDEX_FASTEST && centers.empty()) {
+		printf("createVertexIndex - No recorded brush queries, using the kd-tree\n");
+		type = INDEX_KD_TREE;
+	}
+
+	unique_ptr<VertexIndex> kdTree, grid;
+	if (type != INDEX_GRID) {
+		kdTree = make_unique<VertexKDTree>();
+		kdTree->build(positions, pointNum);
+	}
+	if (type != INDEX_KD_TREE) {
+		grid = make_unique<SpatialGrid>(cellSize);
+		grid->build(positions, pointNum);
+	}
+
+	if (type == INDEX_KD_TREE)
+		return kdTree;
+	else if (type == INDEX_GRID)
+		return grid;
+
+	double kdTreeSeconds = benchmarkVertexIndex(*kdTree, centers, radii);
+	double gridSeconds = benchmarkVertexIndex(*grid, centers, radii);
+	printf("createVertexIndex - Using the %s\n", (gridSeconds < kdTreeSeconds) ? grid->name() : kdTree->name());
+	return (gridSeconds < kdTreeSeconds) ? move(grid) : move(kdTree);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include <Bitmask.h>
+
+#include "kd_tree.h"
+
+////////////////////////////////////////////
+// Support structs and functions for KDTree
+////////////////////////////////////////////
+struct IndexVec3 {
+	size_t index;
+	glm::vec3 point;
+	IndexVec3(size_t index, glm::vec3 point) :index(index), point(point) {}
+	float operator[](size_t index) const { return point[index]; }
+	float &operator[](size_t index) { return point[index]; }
+	IndexVec3 operator-(IndexVec3 p) const {
+		p.point = point - p.point;
+		p.index = -1;
+		return p;
+	}
+};
+
+inline float distanceSquared(IndexVec3 const &a, IndexVec3 const &b) {
+	glm::vec3 diff = a.point - b.point;
+	return glm::dot(diff, diff);
+}
+
+namespace spatial {
+template<> constexpr uint16_t dimensions<IndexVec3>() { return 3; }
+}
+
+//Labels 63 and up share the last bit, so masks are exact for the first 63
+//labels and conservative beyond that
+inline uint64_t labelBit(unsigned char label) {
+	return uint64_t(1) << ((label < 63) ? label : 63);
+}
+
+//Mask of the labels a search can skip: every hidden label plus the label
+//being painted
+uint64_t skippableLabels(Bitmask hidden, int drawColor = -1);
+
+//Spatial index over the vertices used by the painting thread
+class VertexIndex {
+public:
+	virtual ~VertexIndex() {}
+
+	virtual const char* name() const = 0;
+
+	virtual void build(const glm::vec3* positions, size_t pointNum) = 0;
+
+	//Appends every vertex within sqrt(radiusSquared) of p
+	virtual void findNeighbours(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours) const = 0;
+
+	//As above, but vertices whose label is in skipMask may be left out
+	virtual void findNeighbours(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours, uint64_t /*skipMask*/) const {
+		findNeighbours(p, radiusSquared, neighbours);
+	}
+
+	//Appends every vertex within sqrt(radiusSquared) of any of the centers,
+	//each vertex once. Vertices whose label is in skipMask may be left out.
+	virtual void findNeighboursBatch(const glm::vec3* centers, size_t centerNum, float radiusSquared,
+		std::vector<IndexVec3>& neighbours, uint64_t skipMask = 0) const;
+
+	//Vertex nearest to p within sqrt(maxDistanceSquared), or size_t(-1)
+	virtual size_t findNearest(glm::vec3 p, float maxDistanceSquared = std::numeric_limits<float>::max()) const = 0;
+
+	//Mask of the labels of the vertices within radius of p
+	virtual uint64_t labelsInSphere(glm::vec3 p, float radius, const unsigned char* labels) const = 0;
+
+	//Indices that keep per label data recompute it from labels
+	virtual void rebuildLabels(const unsigned char* /*labels*/) {}
+
+	//Refreshes any per label data covering the given vertices after their labels changed
+	template<typename Iter, typename GetIndex>
+	void updateLabels(Iter first, Iter last, GetIndex getIndex, const unsigned char* labels) {
+		if (!tracksLabels())
+			return;
+		bool anyChanged = false;
+		for (Iter it = first; it != last; it++)
+			anyChanged |= markChanged(getIndex(*it));
+		if (anyChanged)
+			refreshChanged(labels);
+	}
+
+	virtual size_t memoryUsage() const = 0;
+
+	//Threads large queries may be split across, 0 for one per core
+	void setThreadCount(unsigned int count) { threadCount = count; }
+
+protected:
+	unsigned int threadCount = 0;
+
+	virtual bool tracksLabels() const { return false; }
+	virtual bool markChanged(size_t /*vertex*/) { return false; }
+	virtual void refreshChanged(const unsigned char* /*labels*/) {}
+};
+
+enum VertexIndexType : int {
+	INDEX_KD_TREE = 0,
+	INDEX_GRID,
+	INDEX_FASTEST		//Whichever answers the recorded brush queries faster
+};
+
+//Index used by the painting thread, chosen at startup
+constexpr VertexIndexType VERTEX_INDEX_TYPE = INDEX_FASTEST;
+
+//Seconds taken to answer every query sphere
+double benchmarkVertexIndex(const VertexIndex& index, const std::vector<glm::vec3>& centers, const std::vector<float>& radii);
+
+//Builds the index of the given type over positions. Grid cells are sized to
+//the median query radius, or to defaultRadius without queries. INDEX_FASTEST
+//builds both, times them on the query spheres and keeps the faster one, and
+//falls back to the kd-tree when there are no queries.
+std::unique_ptr<VertexIndex> createVertexIndex(VertexIndexType type, const glm::vec3* positions, size_t pointNum,
+	const std::vector<glm::vec3>& centers, const std::vector<float>& radii, float defaultRadius);
@@ -0,0 +1,434 @@
+#include "VertexKDTree.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+//Depth to which summary rebuilds spawn a thread for the left subtree
+const int PARALLEL_DEPTH = 3;
+
+//Batch queries are split into the subtrees reached at this depth, and run in
+//parallel when those hold at least PARALLEL_MIN_POINTS points
+const int PARALLEL_TASK_DEPTH = 6;
+const size_t PARALLEL_MIN_POINTS = 65536;
+
+}
+
+void VertexKDTree::build(const vec3* vertexPositions, size_t pointNum) {
+	positions = vertexPositions;
+	order.resize(pointNum);
+	iota(order.begin(), order.end(), uint32_t(0));
+	boundsMin = vec3(0.f);
+	boundsMax = vec3(0.f);
+	for (size_t i = 0; i < pointNum; i++) {
+		boundsMin = (i == 0) ? positions[i] : min(boundsMin, positions[i]);
+		boundsMax = (i == 0) ? positions[i] : max(boundsMax, positions[i]);
+	}
+	buildOrder(0, pointNum, 0);
+
+	treePosition.resize(pointNum);
+	for (size_t i = 0; i < pointNum; i++)
+		treePosition[order[i]] = uint32_t(i);
+
+	//Every label is assumed present until rebuildLabels is called
+	size_t summaryNum = maxSummaryNode(1, pointNum) + 1;
+	summaries.assign(summaryNum, ~uint64_t(0));
+	dirty.assign(summaryNum, 0);
+}
+
+//Same split as spatial::build_kdTree_inplace, moving vertex numbers only
+void VertexKDTree::buildOrder(size_t begin, size_t end, uint16_t dim) {
+	if (end - begin <= 1)
+		return;
+
+	size_t mid = begin + (end - begin) / 2;
+	const vec3* points = positions;
+	nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [points, dim](uint32_t a, uint32_t b) {
+		return points[a][dim] < points[b][dim];
+	});
+
+	uint16_t nextDim = spatial::nextDimension<spatial::dimensions<IndexVec3>()>(dim);
+	buildOrder(begin, mid, nextDim);
+	buildOrder(mid + 1, end, nextDim);
+}
+
+size_t VertexKDTree::maxSummaryNode(size_t node, size_t count) const {
+	if (count < SUMMARY_MIN_SIZE)
+		return 0;
+	size_t half = count / 2;
+	return std::max(node, std::max(maxSummaryNode(2 * node, half), maxSummaryNode(2 * node + 1, count - half - 1)));
+}
+
+uint64_t VertexKDTree::rangeLabels(size_t begin, size_t end, const unsigned char* labels) const {
+	uint64_t mask = 0;
+	for (size_t i = begin; i < end; i++)
+		mask |= labelBit(labels[order[i]]);
+	return mask;
+}
+
+uint64_t VertexKDTree::childLabels(size_t node, size_t begin, size_t end, const unsigned char* labels) const {
+	return (end - begin >= SUMMARY_MIN_SIZE) ? summaries[node] : rangeLabels(begin, end, labels);
+}
+
+uint64_t VertexKDTree::buildSummary(size_t node, size_t begin, size_t end, const unsigned char* labels, int parallelDepth) {
+	if (end - begin < SUMMARY_MIN_SIZE)
+		return rangeLabels(begin, end, labels);
+
+	size_t mid = begin + (end - begin) / 2;
+	uint64_t left, right;
+	if (parallelDepth > 0) {
+		thread leftThread([&]() { left = buildSummary(2 * node, begin, mid, labels, parallelDepth - 1); });
+		right = buildSummary(2 * node + 1, mid + 1, end, labels, parallelDepth - 1);
+		leftThread.join();
+	}
+	else {
+		left = buildSummary(2 * node, begin, mid, labels, 0);
+		right = buildSummary(2 * node + 1, mid + 1, end, labels, 0);
+	}
+
+	summaries[node] = left | right | labelBit(labels[order[mid]]);
+	dirty[node] = 0;
+	return summaries[node];
+}
+
+void VertexKDTree::rebuildLabels(const unsigned char* labels) {
+	if (!summaries.empty())
+		buildSummary(1, 0, order.size(), labels, PARALLEL_DEPTH);
+}
+
+bool VertexKDTree::markDirty(size_t position) {
+	size_t node = 1, begin = 0, end = order.size();
+	bool marked = false;
+	while (end - begin >= SUMMARY_MIN_SIZE) {
+		dirty[node] = 1;
+		marked = true;
+		size_t mid = begin + (end - begin) / 2;
+		if (position == mid)
+			break;
+		else if (position < mid) {
+			node = 2 * node;
+			end = mid;
+		}
+		else {
+			node = 2 * node + 1;
+			begin = mid + 1;
+		}
+	}
+	return marked;
+}
+
+void VertexKDTree::refreshDirty(size_t node, size_t begin, size_t end, const unsigned char* labels) {
+	if (end - begin < SUMMARY_MIN_SIZE || !dirty[node])
+		return;
+	dirty[node] = 0;
+
+	size_t mid = begin + (end - begin) / 2;
+	refreshDirty(2 * node, begin, mid, labels);
+	refreshDirty(2 * node + 1, mid + 1, end, labels);
+	summaries[node] = childLabels(2 * node, begin, mid, labels)
+		| childLabels(2 * node + 1, mid + 1, end, labels)
+		| labelBit(labels[order[mid]]);
+}
+
+void VertexKDTree::findNeighbours(vec3 p, float radiusSquared, vector<IndexVec3>& neighbours) const {
+	search(1, 0, order.size(), 0, p, radiusSquared, neighbours, 0);
+}
+
+void VertexKDTree::findNeighbours(vec3 p, float radiusSquared, vector<IndexVec3>& neighbours, uint64_t skipMask) const {
+	search(1, 0, order.size(), 0, p, radiusSquared, neighbours, skipMask);
+}
+
+//Same traversal as spatial::kdTree_findNeighbours, returning early from
+//subtrees whose summary only holds skippable labels. Small subtrees are
+//scanned straight through.
+void VertexKDTree::search(size_t node, size_t begin, size_t end, uint16_t dim, vec3 p, float radiusSquared,
+	vector<IndexVec3>& neighbours, uint64_t skipMask) const
+{
+	if (end - begin < SUMMARY_MIN_SIZE) {
+		for (size_t i = begin; i < end; i++) {
+			vec3 diff = pointAt(i) - p;
+			if (dot(diff, diff) <= radiusSquared)
+				neighbours.push_back(entry(i));
+		}
+		return;
+	}
+	if ((summaries[node] & ~skipMask) == 0)
+		return;
+
+	size_t mid = begin + (end - begin) / 2;
+	const vec3& splitPoint = pointAt(mid);
+	vec3 diff = splitPoint - p;
+	if (dot(diff, diff) <= radiusSquared)
+		neighbours.push_back(entry(mid));
+
+	uint16_t nextDim = spatial::nextDimension<spatial::dimensions<IndexVec3>()>(dim);
+	float planeDist = p[dim] - splitPoint[dim];
+	if (planeDist <= 0.f) {
+		search(2 * node, begin, mid, nextDim, p, radiusSquared, neighbours, skipMask);
+		if (planeDist*planeDist <= radiusSquared)
+			search(2 * node + 1, mid + 1, end, nextDim, p, radiusSquared, neighbours, skipMask);
+	}
+	else {
+		search(2 * node + 1, mid + 1, end, nextDim, p, radiusSquared, neighbours, skipMask);
+		if (planeDist*planeDist <= radiusSquared)
+			search(2 * node, begin, mid, nextDim, p, radiusSquared, neighbours, skipMask);
+	}
+}
+
+void VertexKDTree::findNeighboursBatch(const vec3* centers, size_t centerNum, float radiusSquared,
+	vector<IndexVec3>& neighbours, uint64_t skipMask) const
+{
+	if (centerNum == 0 || order.empty())
+		return;
+
+	//Lists are kept per thread, so steady querying doesn't allocate
+	static thread_local vector<uint32_t> active;
+	static thread_local vector<BatchTask> tasks;
+	static thread_local vector<uint32_t> taskCenters;
+	tasks.clear();
+	taskCenters.clear();
+
+	//Stack of active center lists, each child's list pushed after its parent's
+	active.resize(centerNum);
+	for (size_t i = 0; i < centerNum; i++)
+		active[i] = uint32_t(i);
+
+	collectBatchTasks(1, 0, order.size(), 0, 0, centers, active, 0, radiusSquared, skipMask, tasks, taskCenters);
+
+	size_t taskPoints = 0;
+	for (const BatchTask& task : tasks)
+		taskPoints += task.end - task.begin;
+	unsigned int threadNum = (threadCount > 0) ? threadCount : workerThreadCount();
+
+	//Each chunk of tasks fills its own list, joined in task order. The lists
+	//are bound here since other threads see their own thread_local ones.
+	size_t chunkNum = (taskPoints >= PARALLEL_MIN_POINTS) ? std::min(size_t(threadNum), tasks.size()) : 1;
+	vector<vector<IndexVec3>> chunkNeighbours((chunkNum > 1) ? chunkNum : 0);
+	const vector<BatchTask>& taskList = tasks;
+	const vector<uint32_t>& centerList = taskCenters;
+	parallelChunks(0, tasks.size(), chunkNum, [&](size_t chunk, size_t taskBegin, size_t taskEnd) {
+		vector<IndexVec3>& found = (chunkNum > 1) ? chunkNeighbours[chunk] : neighbours;
+		static thread_local vector<uint32_t> taskActive;
+		for (size_t t = taskBegin; t < taskEnd; t++) {
+			const BatchTask& task = taskList[t];
+			if (task.node == 0) {
+				found.push_back(entry(task.begin));
+				continue;
+			}
+			taskActive.assign(centerList.begin() + task.activeBegin, centerList.begin() + task.activeEnd);
+			searchBatch(task.node, task.begin, task.end, task.dim, centers, taskActive, 0, radiusSquared, found, skipMask);
+		}
+	});
+	if (chunkNum > 1) {
+		for (const auto& found : chunkNeighbours)
+			neighbours.insert(neighbours.end(), found.begin(), found.end());
+	}
+}
+
+//Follows searchBatch down to PARALLEL_TASK_DEPTH, recording split points and
+//subtrees in the order searchBatch would visit them
+void VertexKDTree::collectBatchTasks(size_t node, size_t begin, size_t end, uint16_t dim, int depth, const vec3* centers,
+	vector<uint32_t>& active, size_t activeBegin, float radiusSquared, uint64_t skipMask,
+	vector<BatchTask>& tasks, vector<uint32_t>& taskCenters) const
+{
+	if (end <= begin)
+		return;
+
+	size_t activeEnd = active.size();
+	if (depth == PARALLEL_TASK_DEPTH || end - begin < SUMMARY_MIN_SIZE) {
+		BatchTask task = { node, begin, end, dim, taskCenters.size(), 0 };
+		taskCenters.insert(taskCenters.end(), active.begin() + activeBegin, active.end());
+		task.activeEnd = taskCenters.size();
+		tasks.push_back(task);
+		return;
+	}
+	if ((summaries[node] & ~skipMask) == 0)
+		return;
+
+	size_t mid = begin + (end - begin) / 2;
+	const vec3& splitPoint = pointAt(mid);
+	for (size_t a = activeBegin; a < activeEnd; a++) {
+		vec3 diff = splitPoint - centers[active[a]];
+		if (dot(diff, diff) <= radiusSquared) {
+			BatchTask task = { 0, mid, mid + 1, dim, 0, 0 };
+			tasks.push_back(task);
+			break;
+		}
+	}
+
+	uint16_t nextDim = spatial::nextDimension<spatial::dimensions<IndexVec3>()>(dim);
+	for (int side = 0; side < 2; side++) {
+		for (size_t a = activeBegin; a < activeEnd; a++) {
+			float planeDist = centers[active[a]][dim] - splitPoint[dim];
+			if (((side == 0) ? planeDist <= 0.f : planeDist > 0.f) || planeDist*planeDist <= radiusSquared)
+				active.push_back(active[a]);
+		}
+		if (active.size() > activeEnd) {
+			if (side == 0)
+				collectBatchTasks(2 * node, begin, mid, nextDim, depth + 1, centers, active, activeEnd, radiusSquared, skipMask, tasks, taskCenters);
+			else
+				collectBatchTasks(2 * node + 1, mid + 1, end, nextDim, depth + 1, centers, active, activeEnd, radiusSquared, skipMask, tasks, taskCenters);
+		}
+		active.resize(activeEnd);
+	}
+}
+
+void VertexKDTree::searchBatch(size_t node, size_t begin, size_t end, uint16_t dim, const vec3* centers,
+	vector<uint32_t>& active, size_t activeBegin, float radiusSquared,
+	vector<IndexVec3>& neighbours, uint64_t skipMask) const
+{
+	if (end <= begin)
+		return;
+
+	size_t activeEnd = active.size();
+	auto reached = [&](const vec3& point) {
+		for (size_t a = activeBegin; a < activeEnd; a++) {
+			vec3 diff = point - centers[active[a]];
+			if (dot(diff, diff) <= radiusSquared)
+				return true;
+		}
+		return false;
+	};
+
+	if (end - begin < SUMMARY_MIN_SIZE) {
+		for (size_t i = begin; i < end; i++) {
+			if (reached(pointAt(i)))
+				neighbours.push_back(entry(i));
+		}
+		return;
+	}
+	if ((summaries[node] & ~skipMask) == 0)
+		return;
+
+	size_t mid = begin + (end - begin) / 2;
+	const vec3& splitPoint = pointAt(mid);
+	if (reached(splitPoint))
+		neighbours.push_back(entry(mid));
+
+	uint16_t nextDim = spatial::nextDimension<spatial::dimensions<IndexVec3>()>(dim);
+	for (int side = 0; side < 2; side++) {
+		for (size_t a = activeBegin; a < activeEnd; a++) {
+			float planeDist = centers[active[a]][dim] - splitPoint[dim];
+			if (((side == 0) ? planeDist <= 0.f : planeDist > 0.f) || planeDist*planeDist <= radiusSquared)
+				active.push_back(active[a]);
+		}
+		if (active.size() > activeEnd) {
+			if (side == 0)
+				searchBatch(2 * node, begin, mid, nextDim, centers, active, activeEnd, radiusSquared, neighbours, skipMask);
+			else
+				searchBatch(2 * node + 1, mid + 1, end, nextDim, centers, active, activeEnd, radiusSquared, neighbours, skipMask);
+		}
+		active.resize(activeEnd);
+	}
+}
+
+size_t VertexKDTree::findNearest(vec3 p, float maxDistanceSquared) const {
+	size_t vertex = size_t(-1);
+	float distSquared = maxDistanceSquared;
+	findKNearest(p, 1, &vertex, &distSquared, maxDistanceSquared);
+	return vertex;
+}
+
+size_t VertexKDTree::findKNearest(vec3 p, size_t k, size_t* vertices, float* distancesSquared, float maxDistanceSquared) const {
+	spatial::BoundedNearestHeap<float> heap = { vertices, distancesSquared, 0, k, maxDistanceSquared };
+	nearestSearch(0, order.size(), 0, p, heap);
+	heap.sortAscending();
+	return heap.size;
+}
+
+void VertexKDTree::findKNearestBatch(const vec3* queries, size_t queryNum, size_t k, size_t* vertices, float* distancesSquared,
+	float maxDistanceSquared) const
+{
+	parallelFor(0, queryNum, [&](size_t q) {
+		size_t found = findKNearest(queries[q], k, vertices + q*k, distancesSquared + q*k, maxDistanceSquared);
+		for (size_t i = found; i < k; i++) {
+			vertices[q*k + i] = size_t(-1);
+			distancesSquared[q*k + i] = maxDistanceSquared;
+		}
+	}, 256);
+}
+
+//Visits the side of each split holding p first, and the other side only if
+//the split plane is nearer than the current kth nearest vertex. The heap keeps
+//vertex numbers rather than tree positions.
+void VertexKDTree::nearestSearch(size_t begin, size_t end, uint16_t dim, vec3 p, spatial::BoundedNearestHeap<float>& heap) const {
+	if (end <= begin)
+		return;
+
+	size_t mid = begin + (end - begin) / 2;
+	const vec3& splitPoint = pointAt(mid);
+	vec3 diff = splitPoint - p;
+	heap.push(order[mid], dot(diff, diff));
+	if (end - begin == 1)
+		return;
+
+	float planeDist = p[dim] - splitPoint[dim];
+	uint16_t nextDim = spatial::nextDimension<spatial::dimensions<IndexVec3>()>(dim);
+	if (planeDist <= 0.f) {
+		nearestSearch(begin, mid, nextDim, p, heap);
+		if (planeDist*planeDist <= heap.bound())
+			nearestSearch(mid + 1, end, nextDim, p, heap);
+	}
+	else {
+		nearestSearch(mid + 1, end, nextDim, p, heap);
+		if (planeDist*planeDist <= heap.bound())
+			nearestSearch(begin, mid, nextDim, p, heap);
+	}
+}
+
+uint64_t VertexKDTree::labelsInSphere(vec3 p, float radius, const unsigned char* labels) const {
+	return sphereLabels(1, 0, order.size(), 0, boundsMin, boundsMax, p, radius, labels);
+}
+
+uint64_t VertexKDTree::sphereLabels(size_t node, size_t begin, size_t end, uint16_t dim, vec3 lower, vec3 upper,
+	vec3 p, float radius, const unsigned char* labels) const
+{
+	if (end <= begin)
+		return 0;
+
+	vec3 closest = clamp(p, lower, upper);
+	if (dot(closest - p, closest - p) > radius*radius)
+		return 0;
+
+	if (end - begin < SUMMARY_MIN_SIZE) {
+		uint64_t mask = 0;
+		for (size_t i = begin; i < end; i++) {
+			vec3 diff = pointAt(i) - p;
+			if (dot(diff, diff) <= radius*radius)
+				mask |= labelBit(labels[order[i]]);
+		}
+		return mask;
+	}
+
+	//Every point is inside if the farthest corner of the bounds is
+	vec3 farthest = max(abs(lower - p), abs(upper - p));
+	if (dot(farthest, farthest) <= radius*radius)
+		return summaries[node];
+
+	size_t mid = begin + (end - begin) / 2;
+	const vec3& splitPoint = pointAt(mid);
+	vec3 diff = splitPoint - p;
+	uint64_t mask = 0;
+	if (dot(diff, diff) <= radius*radius)
+		mask |= labelBit(labels[order[mid]]);
+
+	uint16_t nextDim = spatial::nextDimension<spatial::dimensions<IndexVec3>()>(dim);
+	vec3 leftUpper = upper;
+	leftUpper[dim] = splitPoint[dim];
+	vec3 rightLower = lower;
+	rightLower[dim] = splitPoint[dim];
+	mask |= sphereLabels(2 * node, begin, mid, nextDim, lower, leftUpper, p, radius, labels);
+	mask |= sphereLabels(2 * node + 1, mid + 1, end, nextDim, rightLower, upper, p, radius, labels);
+	return mask;
+}
+
+size_t VertexKDTree::memoryUsage() const {
+	return order.capacity()*sizeof(uint32_t) + treePosition.capacity()*sizeof(uint32_t)
+		+ summaries.capacity()*sizeof(uint64_t) + dirty.capacity();
+}
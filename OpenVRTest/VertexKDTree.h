@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "VertexIndex.h"
+
+//Implicit kd-tree over the vertices, laid out as in kd_tree.h but holding
+//only the vertex at each tree position and reading coordinates from the
+//positions it was built on, which have to outlive it. Nodes holding at least
+//SUMMARY_MIN_SIZE points also store a bitmask of the labels beneath them,
+//indexed in heap order (root 1, children 2i and 2i + 1). Searches use the
+//masks to skip subtrees that only contain skippable labels.
+class VertexKDTree : public VertexIndex {
+public:
+	static const size_t SUMMARY_MIN_SIZE = 32;
+
+	const char* name() const override { return "kd-tree"; }
+
+	void build(const glm::vec3* positions, size_t pointNum) override;
+
+	//Appends every vertex within sqrt(radiusSquared) of p
+	void findNeighbours(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours) const override;
+
+	//As above, but vertices whose label is in skipMask may be left out
+	void findNeighbours(glm::vec3 p, float radiusSquared, std::vector<IndexVec3>& neighbours, uint64_t skipMask) const override;
+
+	//All centers are answered in one traversal. Each subtree is visited once
+	//with the centers whose spheres reach it, so vertices come out once each.
+	//When the subtrees reached below PARALLEL_TASK_DEPTH hold at least
+	//PARALLEL_MIN_POINTS points they are searched on separate threads, and
+	//their results are joined in the order the serial traversal finds them.
+	void findNeighboursBatch(const glm::vec3* centers, size_t centerNum, float radiusSquared,
+		std::vector<IndexVec3>& neighbours, uint64_t skipMask = 0) const override;
+
+	//Vertex nearest to p within sqrt(maxDistanceSquared), or size_t(-1)
+	size_t findNearest(glm::vec3 p, float maxDistanceSquared = std::numeric_limits<float>::max()) const override;
+
+	//Writes the indices and squared distances of the k vertices nearest to p,
+	//nearest first, and returns how many were found
+	size_t findKNearest(glm::vec3 p, size_t k, size_t* vertices, float* distancesSquared,
+		float maxDistanceSquared = std::numeric_limits<float>::max()) const;
+
+	//Answers queryNum k-nearest queries split across worker threads. Query q
+	//writes to vertices[q*k..(q+1)*k) and distancesSquared[q*k..(q+1)*k),
+	//slots past the number found get size_t(-1).
+	void findKNearestBatch(const glm::vec3* queries, size_t queryNum, size_t k, size_t* vertices, float* distancesSquared,
+		float maxDistanceSquared = std::numeric_limits<float>::max()) const;
+
+	//Mask of the labels of the vertices within radius of p. Subtrees entirely
+	//inside the sphere are answered from their summaries.
+	uint64_t labelsInSphere(glm::vec3 p, float radius, const unsigned char* labels) const override;
+
+	//Recomputes every summary from labels
+	void rebuildLabels(const unsigned char* labels) override;
+
+	size_t memoryUsage() const override;
+
+protected:
+	bool tracksLabels() const override { return !summaries.empty(); }
+	bool markChanged(size_t vertex) override { return markDirty(treePosition[vertex]); }
+	void refreshChanged(const unsigned char* labels) override { refreshDirty(1, 0, order.size(), labels); }
+
+private:
+	const glm::vec3* positions = nullptr;
+	std::vector<uint32_t> order;			//Vertex at each tree position
+	std::vector<uint32_t> treePosition;		//Position of each vertex in order, to find the summaries above it
+	std::vector<uint64_t> summaries;
+	std::vector<unsigned char> dirty;
+	glm::vec3 boundsMin, boundsMax;
+
+	const glm::vec3& pointAt(size_t position) const { return positions[order[position]]; }
+	IndexVec3 entry(size_t position) const { return IndexVec3(order[position], pointAt(position)); }
+
+	void buildOrder(size_t begin, size_t end, uint16_t dim);
+	size_t maxSummaryNode(size_t node, size_t count) const;
+	uint64_t rangeLabels(size_t begin, size_t end, const unsigned char* labels) const;
+	uint64_t childLabels(size_t node, size_t begin, size_t end, const unsigned char* labels) const;
+	uint64_t buildSummary(size_t node, size_t begin, size_t end, const unsigned char* labels, int parallelDepth);
+	bool markDirty(size_t position);
+	void refreshDirty(size_t node, size_t begin, size_t end, const unsigned char* labels);
+	void search(size_t node, size_t begin, size_t end, uint16_t dim, glm::vec3 p, float radiusSquared,
+		std::vector<IndexVec3>& neighbours, uint64_t skipMask) const;
+	void nearestSearch(size_t begin, size_t end, uint16_t dim, glm::vec3 p, spatial::BoundedNearestHeap<float>& heap) const;
+	void searchBatch(size_t node, size_t begin, size_t end, uint16_t dim, const glm::vec3* centers,
+		std::vector<uint32_t>& active, size_t activeBegin, float radiusSquared,
+		std::vector<IndexVec3>& neighbours, uint64_t skipMask) const;
+
+	//Subtree left for searchBatch with its active centers, or, when node is
+	//0, the split point at begin already found
+	struct BatchTask {
+		size_t node, begin, end;
+		uint16_t dim;
+		size_t activeBegin, activeEnd;		//Range of the task's centers in the shared list
+	};
+	void collectBatchTasks(size_t node, size_t begin, size_t end, uint16_t dim, int depth, const glm::vec3* centers,
+		std::vector<uint32_t>& active, size_t activeBegin, float radiusSquared, uint64_t skipMask,
+		std::vector<BatchTask>& tasks, std::vector<uint32_t>& taskCenters) const;
+	uint64_t sphereLabels(size_t node, size_t begin, size_t end, uint16_t dim, glm::vec3 lower, glm::vec3 upper,
+		glm::vec3 p, float radius, const unsigned char* labels) const;
+};
@@ -1,6 +1,8 @@
 //#define _CRT_SECURE_NO_WARNINGS
 
 #include "VolumeIO.h"
+#include "ParallelFor.h"
+#include "Profiler.h"
 #include <stdio.h>
 #include <vector>
 #include <algorithm>
@@ -103,6 +105,7 @@ string findFilenameVariation(string filepath) {
 
 
 bool saveVolume(std::string saveFileName, std::string objName, const unsigned char* colors, int pointNum) {
+	PROFILE_ZONE("Save volume");
 	std::ofstream f(saveFileName.c_str(), ios::binary);
 	if (!f.is_open()) {
 		printf("VolumeIO::saveVolume - File %s could not be opened\n", saveFileName.c_str());
@@ -120,6 +123,7 @@ bool saveVolume(std::string saveFileName, std::string objName, const unsigned ch
 }
 
 bool loadVolume(std::string saveFileName, MeshInfoLoader* minfo, std::vector<unsigned char>* colors, std::string* objName) {
+	PROFILE_ZONE("Load volume");
 	std::ifstream f(saveFileName.c_str());
 	if (!f.is_open()) {
 		printf("VolumeIO::loadVolume - File %s could not be opened\n", saveFileName.c_str());
@@ -192,7 +196,7 @@ std::vector<glm::vec3> colorMapLoader(std::string colorFileName) {
 std::string createPLYWithColors(std::string filename, 
 	unsigned int* faces, unsigned int faceNum,
 	glm::vec3* positions, glm::vec3* normals, const unsigned char* colors, 
-	glm::vec3* colorMap, unsigned int pointNum, Bitmask visibility)
+	const glm::vec3* colorMap, unsigned int pointNum, Bitmask visibility)
 {
 	std::filebuf fb;
 	fb.open(filename, std::ios::out | std::ios::binary);
@@ -240,4 +244,77 @@ std::string createPLYWithColors(std::string filename,
 	fb.close();
 
 	return filename;
-}
\ No newline at end of file
+}
+
+std::string createCompactedPLY(std::string filename,
+	const unsigned int* faces, unsigned int faceNum,
+	const glm::vec3* positions, const glm::vec3* normals, const unsigned char* colors,
+	const glm::vec3* colorMap, unsigned int pointNum, Bitmask visibility)
+{
+	std::filebuf fb;
+	fb.open(filename, std::ios::out | std::ios::binary);
+	std::ostream outstream(&fb);
+	if (outstream.fail()) throw std::runtime_error("failed to open " + string(filename));
+
+	//New index of each kept vertex from a prefix sum over keep flags
+	std::vector<unsigned int> newIndex(size_t(pointNum) + 1, 0);
+	parallelFor(0, pointNum, [&](size_t i) { newIndex[i] = (visibility.test(colors[i])) ? 0 : 1; });
+	unsigned int newPointNum = parallelExclusiveScan(newIndex.data(), size_t(pointNum) + 1);
+	auto kept = [&](unsigned int i) { return newIndex[i + 1] != newIndex[i]; };
+
+	std::vector<unsigned int> newFaceIndex(size_t(faceNum) + 1, 0);
+	parallelFor(0, faceNum, [&](size_t i) {
+		newFaceIndex[i] = (kept(faces[3 * i]) && kept(faces[3 * i + 1]) && kept(faces[3 * i + 2])) ? 1 : 0;
+	});
+	unsigned int newFaceNum = parallelExclusiveScan(newFaceIndex.data(), size_t(faceNum) + 1);
+
+	std::vector<vec3> newPositions(newPointNum);
+	std::vector<vec3> newNormals(newPointNum);
+	std::vector<unsigned char> newLabels(newPointNum);
+	std::vector<unsigned char> newColors(3 * size_t(newPointNum));
+	parallelFor(0, pointNum, [&](size_t i) {
+		if (!kept(i))
+			return;
+		unsigned int j = newIndex[i];
+		newPositions[j] = positions[i];
+		newNormals[j] = normals[i];
+		newLabels[j] = colors[i];
+		vec3 color = colorMap[colors[i]];
+		newColors[3 * j] = color.x*255.f;
+		newColors[3 * j + 1] = color.y*255.f;
+		newColors[3 * j + 2] = color.z*255.f;
+	});
+
+	std::vector<unsigned int> newFaces(3 * size_t(newFaceNum));
+	parallelFor(0, faceNum, [&](size_t i) {
+		if (newFaceIndex[i + 1] == newFaceIndex[i])
+			return;
+		size_t j = newFaceIndex[i];
+		for (size_t corner = 0; corner < 3; corner++)
+			newFaces[3 * j + corner] = newIndex[faces[3 * i + corner]];
+	});
+
+	using namespace tinyply;
+
+	PlyFile plyOutput;
+
+	plyOutput.add_properties_to_element("vertex", { "x", "y", "z" },
+		Type::FLOAT32, newPointNum, reinterpret_cast<uint8_t*>(newPositions.data()), Type::INVALID, 0);
+	plyOutput.add_properties_to_element("vertex", { "nx", "ny", "nz" },
+		Type::FLOAT32, newPointNum, reinterpret_cast<uint8_t*>(newNormals.data()), Type::INVALID, 0);
+	plyOutput.add_properties_to_element("vertex", { "red", "green", "blue" },
+		Type::UINT8, newPointNum, newColors.data(), Type::INVALID, 0);
+	plyOutput.add_properties_to_element("face", { "vertex_indices" },
+		Type::UINT32, newFaceNum, reinterpret_cast<uint8_t*>(newFaces.data()), Type::UINT8, 3);
+
+	plyOutput.write(outstream, true);
+
+	fb.close();
+
+	printf("VolumeIO::createCompactedPLY - Kept %u of %u points and %u of %u faces\n",
+		newPointNum, pointNum, newFaceNum, faceNum);
+
+	std::string clrFilename = swapExtension(filename, "clr");
+	saveVolume(clrFilename, filename, newLabels.data(), newPointNum);
+	return clrFilename;
+}
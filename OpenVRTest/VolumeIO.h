@@ -19,4 +19,12 @@ std::string findFilenameVariation(std::string filepath);
 std::string createPLYWithColors(std::string filename,
 	unsigned int* faces, unsigned int faceNum,
 	glm::vec3* positions, glm::vec3* normals, const unsigned char* colors,
-	glm::vec3* colorMap, unsigned int pointNum, Bitmask visibility);
\ No newline at end of file
+	const glm::vec3* colorMap, unsigned int pointNum, Bitmask visibility);
+
+//Like createPLYWithColors, but vertices with a hidden label are removed along
+//with every face using one, and the remaining indices are compacted. A .clr
+//for the compacted mesh is written beside the .ply. Returns the .clr filename.
+std::string createCompactedPLY(std::string filename,
+	const unsigned int* faces, unsigned int faceNum,
+	const glm::vec3* positions, const glm::vec3* normals, const unsigned char* colors,
+	const glm::vec3* colorMap, unsigned int pointNum, Bitmask visibility);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+
+//Unbounded queue handed from one thread to another. The consumer takes
+//everything queued at once, so nothing pushed between its ticks is lost,
+//and can sleep until something is pushed.
+template<typename T>
+class WorkQueue {
+public:
+	void push(T item) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			items.push_back(std::move(item));
+		}
+		pushed.notify_one();
+	}
+
+	//Replaces out with every queued item, oldest first
+	void drain(std::vector<T>* out) {
+		out->clear();
+		std::lock_guard<std::mutex> lock(mutex);
+		std::swap(*out, items);
+	}
+
+	//As drain, but blocks until there is at least one item
+	void waitAndDrain(std::vector<T>* out) {
+		out->clear();
+		std::unique_lock<std::mutex> lock(mutex);
+		pushed.wait(lock, [&]() { return !items.empty(); });
+		std::swap(*out, items);
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.size();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable pushed;
+	std::vector<T> items;
+};
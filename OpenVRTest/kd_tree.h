@@ -10,6 +10,9 @@
 
 #include <algorithm>
 #include <iterator>
+#include <limits>
+#include <vector>
+#include <stdint.h>
 
 namespace spatial {
 
@@ -131,4 +134,64 @@ void kdTree_findNeighbours(
   }
 }
 
+// Max-heap of the k closest points found so far, stored in caller provided
+// buffers of k offsets and k squared distances
+template <typename Float> struct BoundedNearestHeap {
+  size_t *offsets;
+  Float *distancesSquared;
+  size_t size;
+  size_t capacity;
+  Float maxDistanceSquared; // points farther than this are never kept
+
+  // Squared distance a point has to beat to be kept
+  Float bound() const {
+    return (size < capacity) ? maxDistanceSquared : distancesSquared[0];
+  }
+
+  void push(size_t offset, Float distSquared) {
+    if (capacity == 0 || distSquared > bound())
+      return;
+    if (size < capacity) {
+      size_t i = size++;
+      while (i > 0 && distancesSquared[(i - 1) / 2] < distSquared) {
+        offsets[i] = offsets[(i - 1) / 2];
+        distancesSquared[i] = distancesSquared[(i - 1) / 2];
+        i = (i - 1) / 2;
+      }
+      offsets[i] = offset;
+      distancesSquared[i] = distSquared;
+    } else
+      replaceTop(offset, distSquared, size);
+  }
+
+  // Sorts the kept points nearest first
+  void sortAscending() {
+    for (size_t end = size; end > 1; end--) {
+      size_t topOffset = offsets[0];
+      Float topDistance = distancesSquared[0];
+      replaceTop(offsets[end - 1], distancesSquared[end - 1], end - 1);
+      offsets[end - 1] = topOffset;
+      distancesSquared[end - 1] = topDistance;
+    }
+  }
+
+private:
+  void replaceTop(size_t offset, Float distSquared, size_t heapSize) {
+    size_t i = 0;
+    while (2 * i + 1 < heapSize) {
+      size_t child = 2 * i + 1;
+      if (child + 1 < heapSize &&
+          distancesSquared[child + 1] > distancesSquared[child])
+        child++;
+      if (distancesSquared[child] <= distSquared)
+        break;
+      offsets[i] = offsets[child];
+      distancesSquared[i] = distancesSquared[child];
+      i = child;
+    }
+    offsets[i] = offset;
+    distancesSquared[i] = distSquared;
+  }
+};
+
 } // namepace spatial
\ No newline at end of file
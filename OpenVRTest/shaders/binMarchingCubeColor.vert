@@ -4,8 +4,19 @@
 
 // location indices for these attributes correspond to those specified in the
 // InitializeGeometry() function of the main program
+#ifdef QUANTIZED_VERTICES
+// positions as 16 bit fractions of the model's bounding box and normals as
+// 16 bit octahedral coordinates, both unpacked to floats by the GPU
+// (see QuantizedMesh.h)
+layout(location = 0) in vec3 VertexPositionQuantized;
+layout(location = 1) in vec2 VertexNormalOctahedral;
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#else
 layout(location = 0) in vec3 VertexPosition;
 layout(location = 1) in vec3 VertexNormal;
+#endif
 layout(location = 2) in int VertexColorIndex;
 
 layout( secondary_view_offset=1 ) out highp int gl_Layer;
@@ -23,8 +34,23 @@ uniform vec3 colors [MAX_COLOR_NUM];
 uniform uint visibility [MAX_COLOR_NUM/32 + 1];
 const vec3 otherColors[2] = vec3[2](vec3(1, 0, 0), vec3(0, 1, 0));
 
+#ifdef QUANTIZED_VERTICES
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += (n.x >= 0.0) ? -t : t;
+	n.y += (n.y >= 0.0) ? -t : t;
+	return normalize(n);
+}
+#endif
+
 void main()
 {
+#ifdef QUANTIZED_VERTICES
+	vec3 VertexPosition = positionOffset + positionScale*VertexPositionQuantized;
+	vec3 VertexNormal = decodeOctahedral(VertexNormalOctahedral);
+#endif
 	WorldNormal = (model_matrix*vec4(VertexNormal, 0.0)).xyz;
 	WorldPosition = (model_matrix*vec4(VertexPosition, 1.0)).xyz;
 